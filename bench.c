@@ -0,0 +1,678 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "my6502.h"
+#include "my6502_batch.h"
+
+/* Reference implementation. */
+extern void reset6502();
+extern void step6502();
+
+extern uint16_t pc;
+extern uint32_t clockticks6502;
+
+/* Shared by both cores, they never run at the same time. */
+static uint8_t mem[0x10000];
+
+uint8_t read6502(uint16_t address)
+{
+	return mem[address];
+}
+
+void write6502(uint16_t address, uint8_t value)
+{
+	mem[address] = value;
+}
+
+/* Every workload starts at 0x400 and ends trapped in JMP *. Zero page
+ * holds the preset loop counters. */
+struct workload {
+	const char *name;
+	const uint8_t *code;
+	size_t code_sz;
+	uint8_t zp[0x20];
+};
+
+/* Arithmetic and logic on the accumulator, 8 * 65536 * 48 insns. */
+static const uint8_t alu_code[] = {
+	0xA2, 0x00,		/* 0400 l1: LDX #0 */
+	0xA0, 0x00,		/* 0402 l2: LDY #0 */
+	0x18,			/* 0404 l3: CLC */
+	0x69, 0x03,		/* 0405     ADC #3 */
+	0x49, 0x5A,		/* 0407     EOR #$5A */
+	0x29, 0x7F,		/* 0409     AND #$7F */
+	0x09, 0x01,		/* 040B     ORA #1 */
+	0x2A,			/* 040D     ROL A */
+	0xC8,			/* 040E     INY */
+	0xD0, 0xF3,		/* 040F     BNE l3 */
+	0xCA,			/* 0411     DEX */
+	0xD0, 0xEE,		/* 0412     BNE l2 */
+	0xC6, 0x10,		/* 0414     DEC $10 */
+	0xD0, 0xE8,		/* 0416     BNE l1 */
+	0x4C, 0x18, 0x04,	/* 0418     JMP * */
+};
+
+/* Copy 4 KiB from $2000 to $3000 1536 times. */
+static const uint8_t memcpy_code[] = {
+	0xA9, 0x00,		/* 0400 l1: LDA #0 */
+	0x85, 0x00,		/* 0402     STA $00 */
+	0x85, 0x02,		/* 0404     STA $02 */
+	0xA9, 0x20,		/* 0406     LDA #$20 */
+	0x85, 0x01,		/* 0408     STA $01 */
+	0xA9, 0x30,		/* 040A     LDA #$30 */
+	0x85, 0x03,		/* 040C     STA $03 */
+	0xA2, 0x10,		/* 040E     LDX #16 */
+	0xA0, 0x00,		/* 0410 l2: LDY #0 */
+	0xB1, 0x00,		/* 0412 l3: LDA ($00),Y */
+	0x91, 0x02,		/* 0414     STA ($02),Y */
+	0xC8,			/* 0416     INY */
+	0xD0, 0xF9,		/* 0417     BNE l3 */
+	0xE6, 0x01,		/* 0419     INC $01 */
+	0xE6, 0x03,		/* 041B     INC $03 */
+	0xCA,			/* 041D     DEX */
+	0xD0, 0xF0,		/* 041E     BNE l2 */
+	0xC6, 0x10,		/* 0420     DEC $10 */
+	0xD0, 0xDC,		/* 0422     BNE l1 */
+	0xC6, 0x11,		/* 0424     DEC $11 */
+	0xD0, 0xD8,		/* 0426     BNE l1 */
+	0x4C, 0x28, 0x04,	/* 0428     JMP * */
+};
+
+/* Conditional branches on the bits of a counter, taken and not. */
+static const uint8_t branch_code[] = {
+	0xA2, 0x00,		/* 0400 l1: LDX #0 */
+	0x8A,			/* 0402 l2: TXA */
+	0x4A,			/* 0403     LSR A */
+	0x90, 0x02,		/* 0404     BCC +2 */
+	0xE6, 0x20,		/* 0406     INC $20 */
+	0x4A,			/* 0408     LSR A */
+	0xB0, 0x02,		/* 0409     BCS +2 */
+	0xE6, 0x21,		/* 040B     INC $21 */
+	0x4A,			/* 040D     LSR A */
+	0x30, 0x02,		/* 040E     BMI +2 */
+	0xE6, 0x22,		/* 0410     INC $22 */
+	0xC9, 0x10,		/* 0412     CMP #$10 */
+	0xF0, 0x02,		/* 0414     BEQ +2 */
+	0xE6, 0x23,		/* 0416     INC $23 */
+	0xE8,			/* 0418     INX */
+	0xD0, 0xE7,		/* 0419     BNE l2 */
+	0x88,			/* 041B     DEY */
+	0xD0, 0xE2,		/* 041C     BNE l1 */
+	0xC6, 0x10,		/* 041E     DEC $10 */
+	0xD0, 0xDE,		/* 0420     BNE l1 */
+	0x4C, 0x22, 0x04,	/* 0422     JMP * */
+};
+
+/* ADC and SBC in decimal mode, 12 * 65536 * 32 insns. */
+static const uint8_t decimal_code[] = {
+	0xA2, 0x00,		/* 0400 l1: LDX #0 */
+	0xA0, 0x00,		/* 0402 l2: LDY #0 */
+	0xF8,			/* 0404     SED */
+	0x18,			/* 0405 l3: CLC */
+	0x69, 0x19,		/* 0406     ADC #$19 */
+	0x38,			/* 0408     SEC */
+	0xE9, 0x07,		/* 0409     SBC #$07 */
+	0x18,			/* 040B     CLC */
+	0x69, 0x45,		/* 040C     ADC #$45 */
+	0x38,			/* 040E     SEC */
+	0xE9, 0x38,		/* 040F     SBC #$38 */
+	0xC8,			/* 0411     INY */
+	0xD0, 0xF1,		/* 0412     BNE l3 */
+	0xCA,			/* 0414     DEX */
+	0xD0, 0xEB,		/* 0415     BNE l2 */
+	0xD8,			/* 0417     CLD */
+	0xC6, 0x10,		/* 0418     DEC $10 */
+	0xD0, 0xE4,		/* 041A     BNE l1 */
+	0x4C, 0x1C, 0x04,	/* 041C     JMP * */
+};
+
+static const struct workload workloads[] = {
+	{ "alu", alu_code, sizeof(alu_code), { [0x10] = 48 } },
+	{ "memcpy", memcpy_code, sizeof(memcpy_code),
+		{ [0x10] = 0, [0x11] = 6 } },
+	{ "branch", branch_code, sizeof(branch_code), { [0x10] = 24 } },
+	{ "decimal", decimal_code, sizeof(decimal_code), { [0x10] = 32 } },
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+/* Give up on a workload that doesn't trap. */
+#define MAX_INSTRUCTIONS 2000000000ULL
+
+/* Memory at power-on for the current workload. */
+static uint8_t image[0x10000];
+
+static void load_image(void)
+{
+	memcpy(mem, image, sizeof(mem));
+}
+
+static void build_image(const struct workload *w)
+{
+	memset(image, 0, sizeof(image));
+	memcpy(image, w->zp, sizeof(w->zp));
+	memcpy(image + 0x400, w->code, w->code_sz);
+}
+
+static void load_file(const char *file_name)
+{
+	struct stat s;
+	int fd, rc;
+	void *p;
+
+	fd = open(file_name, O_RDONLY);
+	assert(fd >= 0);
+
+	rc = fstat(fd, &s);
+	assert(rc == 0);
+	assert(s.st_size <= sizeof(image));
+
+	p = mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	assert(p != MAP_FAILED);
+
+	memset(image, 0, sizeof(image));
+	memcpy(image, p, s.st_size);
+
+	munmap(p, s.st_size);
+	close(fd);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *workload, const char *core,
+                   uint64_t instructions, uint64_t cycles, double seconds)
+{
+	printf("{\"workload\":\"%s\",\"core\":\"%s\","
+		"\"instructions\":%llu,\"cycles\":%llu,\"seconds\":%.6f,"
+		"\"insns_per_sec\":%.0f,\"cycles_per_sec\":%.0f,"
+		"\"ns_per_insn\":%.3f}\n",
+		workload, core,
+		(unsigned long long)instructions, (unsigned long long)cycles,
+		seconds, instructions / seconds, cycles / seconds,
+		seconds * 1e9 / instructions);
+	fflush(stdout);
+}
+
+/* Run my6502 until the trap and return the number of instructions. */
+static uint64_t bench_my6502(const char *name, int block_cache, int jit)
+{
+	static struct my6502 cpu;
+	enum my6502_stop stop;
+	double t;
+
+	load_image();
+	my6502_init(&cpu, NULL, NULL);
+	my6502_map(&cpu, 0, sizeof(mem), mem,
+		MY6502_MAP_READ | MY6502_MAP_WRITE);
+	my6502_reset(&cpu, 0x400);
+	if (block_cache && my6502_block_cache(&cpu, 1)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	if (jit && my6502_jit(&cpu, 2)) {
+		fprintf(stderr, "no jit\n");
+		exit(1);
+	}
+
+	t = now();
+	stop = my6502_run(&cpu, MAX_INSTRUCTIONS);
+	t = now() - t;
+
+	if (stop != MY6502_STOP_TRAP) {
+		fprintf(stderr, "%s: no trap at pc=0x%04x\n", name, cpu.pc);
+		exit(1);
+	}
+
+	report(name, "my6502", cpu.instructions, cpu.cycles, t);
+#ifdef MY6502_STATS
+	/* Keep stdout to the reports. */
+	my6502_dump_stats(&cpu, stderr);
+#endif
+	my6502_block_cache(&cpu, 0);
+	return cpu.instructions;
+}
+
+/* Run the reference for as many instructions as my6502 did. */
+static void bench_fake6502(const char *name, uint64_t instructions)
+{
+	uint32_t cycles;
+	uint64_t i;
+	double t;
+
+	load_image();
+	reset6502();
+	pc = 0x400;
+	cycles = clockticks6502;
+
+	t = now();
+	for (i = 0; i < instructions; i++) {
+		step6502();
+	}
+	t = now() - t;
+
+	report(name, "fake6502", instructions,
+		(uint32_t)(clockticks6502 - cycles), t);
+}
+
+/* Final state of an instance, RAM as a checksum. */
+struct final {
+	uint16_t pc;
+	uint8_t ac, x, y, sp, sr;
+	uint64_t cycles;
+	uint64_t instructions;
+	uint32_t sum;
+};
+
+static uint32_t checksum(const uint8_t *bytes, size_t size)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		h = (h ^ bytes[i]) * 16777619u;
+	}
+	return h;
+}
+
+static int same_final(const struct final *a, const struct final *b)
+{
+	return a->pc == b->pc && a->ac == b->ac && a->x == b->x
+		&& a->y == b->y && a->sp == b->sp && a->sr == b->sr
+		&& a->cycles == b->cycles && a->instructions == b->instructions
+		&& a->sum == b->sum;
+}
+
+/* The instances of bench_batch() all at once, each one reading the
+ * image until it writes to a page. */
+static void bench_cow(const char *name, unsigned int instances,
+                      const struct final *finals)
+{
+	static uint8_t ram[0x10000];
+	struct my6502 *cpus, *cpu;
+	uint64_t instructions = 0, cycles = 0, copies = 0;
+	unsigned int i, a;
+	struct final f;
+	double t;
+
+	cpus = calloc(instances, sizeof(*cpus));
+	if (!cpus) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	t = now();
+	for (i = 0; i < instances; i++) {
+		cpu = &cpus[i];
+		my6502_init(cpu, NULL, NULL);
+		my6502_map(cpu, 0, sizeof(image), image, MY6502_MAP_COW);
+		my6502_poke(cpu, 0x10, 1 + i % 2);
+		my6502_reset(cpu, 0x400);
+		my6502_run(cpu, MAX_INSTRUCTIONS);
+		instructions += cpu->instructions;
+		cycles += cpu->cycles;
+	}
+	t = now() - t;
+	report(name, "cow", instructions, cycles, t);
+
+	for (i = 0; i < instances; i++) {
+		cpu = &cpus[i];
+		for (a = 0; a < sizeof(ram); a++) {
+			ram[a] = my6502_peek(cpu, a);
+		}
+		f.pc = cpu->pc;
+		f.ac = cpu->ac;
+		f.x = cpu->x;
+		f.y = cpu->y;
+		f.sp = cpu->sp;
+		f.sr = my6502_get_sr(cpu);
+		f.cycles = cpu->cycles;
+		f.instructions = cpu->instructions;
+		f.sum = checksum(ram, sizeof(ram));
+		if (!same_final(&f, &finals[i])) {
+			fprintf(stderr, "%s: instance %u differs at pc=0x%04x\n",
+				name, i, cpu->pc);
+			exit(1);
+		}
+		copies += cpu->cow_copies;
+		my6502_map(cpu, 0, sizeof(image), NULL, 0);
+	}
+
+	printf("{\"workload\":\"%s\",\"core\":\"cow\",\"instances\":%u,"
+		"\"copied_pages\":%llu,\"bytes_per_instance\":%.0f}\n",
+		name, instances, (unsigned long long)copies,
+		sizeof(*cpus) + copies * 256.0 / instances);
+	fflush(stdout);
+	free(cpus);
+}
+
+/* Run so many instances of the workload on my6502 one after another,
+ * then all at once on the batch engine, and check they end up in the
+ * same state. The outer loop counter is cut down to one or two, so the
+ * instances part ways at some point. */
+static void bench_batch(const char *name, unsigned int instances)
+{
+	static struct my6502 cpu;
+	static uint8_t ram[0x10000];
+	struct my6502_batch b;
+	struct final *finals, f;
+	uint64_t instructions = 0, cycles = 0;
+	unsigned int i, a;
+	double t, scalar = 0;
+
+	finals = calloc(instances, sizeof(*finals));
+	if (!finals || my6502_batch_init(&b, instances)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	image[0x11] = 1;
+
+	for (i = 0; i < instances; i++) {
+		image[0x10] = 1 + i % 2;
+		load_image();
+		my6502_init(&cpu, NULL, NULL);
+		my6502_map(&cpu, 0, sizeof(mem), mem,
+			MY6502_MAP_READ | MY6502_MAP_WRITE);
+		my6502_reset(&cpu, 0x400);
+
+		t = now();
+		my6502_run(&cpu, MAX_INSTRUCTIONS);
+		scalar += now() - t;
+
+		finals[i].pc = cpu.pc;
+		finals[i].ac = cpu.ac;
+		finals[i].x = cpu.x;
+		finals[i].y = cpu.y;
+		finals[i].sp = cpu.sp;
+		finals[i].sr = my6502_get_sr(&cpu);
+		finals[i].cycles = cpu.cycles;
+		finals[i].instructions = cpu.instructions;
+		finals[i].sum = checksum(mem, sizeof(mem));
+		instructions += cpu.instructions;
+		cycles += cpu.cycles;
+	}
+	report(name, "my6502", instructions, cycles, scalar);
+
+	bench_cow(name, instances, finals);
+
+	my6502_batch_load(&b, 0, sizeof(image), image);
+	for (i = 0; i < instances; i++) {
+		my6502_batch_poke(&b, i, 0x10, 1 + i % 2);
+		my6502_batch_reset(&b, i, 0x400);
+	}
+
+	t = now();
+	my6502_batch_run(&b, MAX_INSTRUCTIONS);
+	t = now() - t;
+
+	report(name, "batch", instructions, cycles, t);
+
+	for (i = 0; i < instances; i++) {
+		for (a = 0; a < sizeof(ram); a++) {
+			ram[a] = my6502_batch_peek(&b, i, a);
+		}
+		f.pc = b.pc[i];
+		f.ac = b.ac[i];
+		f.x = b.x[i];
+		f.y = b.y[i];
+		f.sp = b.sp[i];
+		f.sr = b.sr[i];
+		f.cycles = b.cycles[i];
+		f.instructions = b.instructions[i];
+		f.sum = checksum(ram, sizeof(ram));
+		if (b.stop[i] != MY6502_STOP_TRAP
+			|| !same_final(&f, &finals[i])) {
+			fprintf(stderr, "%s: instance %u differs at pc=0x%04x\n",
+				name, i, b.pc[i]);
+			exit(1);
+		}
+	}
+
+	my6502_batch_free(&b);
+	free(finals);
+}
+
+/* A loop polling $10, which nothing ever changes. Without an event or
+ * a deadline to skip to, idle skip must not change anything. */
+static const uint8_t idle_code[] = {
+	0xA5, 0x10,		/* 0400 l1: LDA $10 */
+	0xC9, 0x05,		/* 0402     CMP #5 */
+	0xD0, 0xFA,		/* 0404     BNE l1 */
+};
+
+static void check_idle(void)
+{
+	static struct my6502 cpu[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		memset(mem, 0, sizeof(mem));
+		memcpy(mem + 0x400, idle_code, sizeof(idle_code));
+		my6502_init(&cpu[i], NULL, NULL);
+		my6502_map(&cpu[i], 0, sizeof(mem), mem,
+			MY6502_MAP_READ | MY6502_MAP_WRITE);
+		my6502_reset(&cpu[i], 0x400);
+		my6502_idle_skip(&cpu[i], i);
+		my6502_run(&cpu[i], 3000);
+	}
+
+	if (cpu[0].pc != cpu[1].pc || cpu[0].cycles != cpu[1].cycles
+		|| cpu[0].instructions != cpu[1].instructions) {
+		fprintf(stderr, "idle: skipped without an event\n");
+		exit(1);
+	}
+}
+
+#ifndef MY6502_NES_CPU
+
+/* Bruce Clark's NMOS decimal ADC and SBC, "Decimal Mode" appendix B,
+ * which the decimal test of the Klaus suite implements. Return the
+ * accumulator and set NV-BDIZC in *sr from the carry in it. */
+static uint8_t clark_adc(uint8_t a, uint8_t b, uint8_t *sr)
+{
+	int c = *sr & 0x01, al, sum, n;
+
+	al = (a & 0x0F) + (b & 0x0F) + c;
+	if (al >= 0x0A) {
+		al = ((al + 0x06) & 0x0F) + 0x10;
+	}
+	sum = (a & 0xF0) + (b & 0xF0) + al;
+	n = (int8_t)(a & 0xF0) + (int8_t)(b & 0xF0) + al;
+	if (sum >= 0xA0) {
+		sum += 0x60;
+	}
+
+	*sr &= ~0xC3;
+	*sr |= n & 0x80;
+	*sr |= n < -128 || n > 127 ? 0x40 : 0;
+	*sr |= (uint8_t)(a + b + c) == 0 ? 0x02 : 0;
+	*sr |= sum >= 0x100;
+	return sum;
+}
+
+static uint8_t clark_sbc(uint8_t a, uint8_t b, uint8_t *sr)
+{
+	int c = *sr & 0x01, al, diff, bin;
+
+	al = (a & 0x0F) - (b & 0x0F) + c - 1;
+	if (al < 0) {
+		al = ((al - 0x06) & 0x0F) - 0x10;
+	}
+	diff = (a & 0xF0) - (b & 0xF0) + al;
+	if (diff < 0) {
+		diff -= 0x60;
+	}
+
+	/* The flags are binary. */
+	bin = a - b + c - 1;
+	*sr &= ~0xC3;
+	*sr |= bin & 0x80;
+	*sr |= (a ^ b) & (a ^ bin) & 0x80 ? 0x40 : 0;
+	*sr |= (uint8_t)bin == 0 ? 0x02 : 0;
+	*sr |= bin >= 0;
+	return diff;
+}
+
+/* ADC and SBC with every accumulator, operand and carry in decimal
+ * mode, against the above. */
+static void check_decimal(void)
+{
+	static struct my6502 cpu;
+	uint8_t a, b, c, want_ac, want_sr;
+	unsigned int i, sbc;
+
+	memset(mem, 0, sizeof(mem));
+	my6502_init(&cpu, NULL, NULL);
+	my6502_map(&cpu, 0, sizeof(mem), mem,
+		MY6502_MAP_READ | MY6502_MAP_WRITE);
+
+	for (i = 0; i < 0x40000; i++) {
+		sbc = i >> 17;
+		a = i >> 9;
+		b = i >> 1;
+		c = i & 1;
+
+		/* ADC or SBC #b */
+		mem[0x400] = sbc ? 0xE9 : 0x69;
+		mem[0x401] = b;
+		my6502_reset(&cpu, 0x400);
+		cpu.ac = a;
+		my6502_set_sr(&cpu, 0x28 | c);
+		my6502_run(&cpu, 1);
+
+		want_sr = 0x28 | c;
+		want_ac = sbc ? clark_sbc(a, b, &want_sr)
+			: clark_adc(a, b, &want_sr);
+		if (cpu.ac != want_ac || my6502_get_sr(&cpu) != want_sr) {
+			fprintf(stderr, "decimal: %s $%02X, #$%02X, C=%u gives"
+				" $%02X sr %02X, not $%02X sr %02X\n",
+				sbc ? "sbc" : "adc", a, b, c, cpu.ac,
+				my6502_get_sr(&cpu), want_ac, want_sr);
+			exit(1);
+		}
+	}
+}
+
+#endif
+
+static void usage(void)
+{
+	printf("Usage: %s [-b] [-j] [-m] [-n <instances>] [-k <rom.bin>]"
+		" [workload...]\n"
+		"  -b  run my6502 with the block cache\n"
+		"  -j  compile hot blocks, implies -b\n"
+		"  -m  run my6502 only\n"
+		"  -n  run so many instances of the workloads on my6502, sharing"
+		" memory\n"
+		"      copy-on-write, and in a batch\n"
+		"  -k  add the functional test from a file\n"
+		"Workloads: alu memcpy branch decimal, all by default.\n",
+		getprogname());
+}
+
+static void bench(const char *name, int block_cache, int jit, int my_only)
+{
+	uint64_t instructions;
+
+	instructions = bench_my6502(name, block_cache, jit);
+	if (!my_only) {
+		bench_fake6502(name, instructions);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *klaus = NULL;
+	int block_cache = 0;
+	int jit = 0;
+	int my_only = 0;
+	unsigned int instances = 0;
+	int opt;
+	unsigned int i;
+	int j;
+
+	while ((opt = getopt(argc, argv, "bjmn:k:")) != -1) {
+		switch (opt) {
+		case 'b':
+			block_cache = 1;
+			break;
+		case 'j':
+			block_cache = 1;
+			jit = 1;
+			break;
+		case 'm':
+			my_only = 1;
+			break;
+		case 'n':
+			instances = strtoul(optarg, NULL, 0);
+			if (!instances) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'k':
+			klaus = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	for (j = optind; j < argc; j++) {
+		for (i = 0; i < WORKLOAD_COUNT; i++) {
+			if (!strcmp(argv[j], workloads[i].name)) {
+				break;
+			}
+		}
+		if (i == WORKLOAD_COUNT) {
+			usage();
+			return 1;
+		}
+	}
+
+	check_idle();
+#ifndef MY6502_NES_CPU
+	check_decimal();
+#endif
+
+	for (i = 0; i < WORKLOAD_COUNT; i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++) {
+				if (!strcmp(argv[j], workloads[i].name)) {
+					break;
+				}
+			}
+			if (j == argc) {
+				continue;
+			}
+		}
+
+		build_image(&workloads[i]);
+		if (instances) {
+			bench_batch(workloads[i].name, instances);
+		} else {
+			bench(workloads[i].name, block_cache, jit, my_only);
+		}
+	}
+
+	if (klaus) {
+		load_file(klaus);
+		bench("klaus", block_cache, jit, my_only);
+	}
+
+	return 0;
+}
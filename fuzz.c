@@ -0,0 +1,713 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "my6502.h"
+
+/* Differential fuzzer. Each worker is a process with its own pair of
+ * cores, as the reference keeps its state in globals. An input is a
+ * few pages and the registers laid over a fixed base image, run on
+ * both cores in lockstep for a few steps. Inputs reaching a new
+ * outcome of an opcode, i.e. its flags and extra cycles, are kept to
+ * be mutated further. The outcomes seen are shared by the workers. */
+
+/* Reference implementation. */
+extern void step6502();
+
+extern uint16_t pc;
+extern uint8_t sp, a, x, y, status;
+extern uint32_t clockticks6502;
+
+#define CODE_SZ 32
+#define MAX_STEPS 64
+
+/* Saved to and loaded from files as is. */
+struct input {
+	uint8_t code[CODE_SZ];
+	uint8_t zp[0x100];
+	uint8_t stack[0x100];
+	/* Laid at data_page, for absolute and indirect targets. */
+	uint8_t data[0x100];
+	uint8_t pc_lo, pc_hi, ac, x, y, sp, sr, data_page;
+};
+
+static const char *mode_names[0x100] = {
+#define OP(code, name, mode, cycles, flags, kind) [code] = #mode,
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+/* Opcode, those of its N, V, Z and C after that it may change, and its
+ * extra cycles, taken branch or page crossing, up to 3. */
+#define OUTCOMES (0x100 << 6)
+
+static unsigned int outcome(uint8_t opcode, uint8_t sr, unsigned int extra)
+{
+	sr &= my6502_insn_flags(opcode);
+	return opcode << 6 | ((sr >> 4 & 0xC) | (sr & 0x3)) << 2
+		| (extra > 3 ? 3 : extra);
+}
+
+/* Shared by all workers, updates may race which only costs a few
+ * duplicate inputs or reports. */
+struct worker_stats {
+	uint64_t execs;
+	uint64_t divergences;
+	uint64_t corpus;
+};
+
+struct shared {
+	uint8_t coverage[OUTCOMES];
+	/* The first divergence is reported per opcode. */
+	uint8_t reported[0x100];
+	struct worker_stats workers[];
+};
+
+static struct shared *shared;
+
+static uint8_t base[0x10000];
+static uint8_t fake6502_mem[0x10000];
+static uint8_t my6502_mem[0x10000];
+
+/* Addresses written by each core during the current input, restored
+ * from the base image afterwards. */
+#define JOURNAL_SZ (MAX_STEPS * 3)
+
+struct journal {
+	uint16_t addresses[JOURNAL_SZ];
+	/* Where the current step starts. */
+	int step;
+	int len;
+};
+
+static struct journal fake6502_journal;
+static struct journal my6502_journal;
+
+static void journal_add(struct journal *j, uint16_t address)
+{
+	assert(j->len < JOURNAL_SZ);
+	j->addresses[j->len++] = address;
+}
+
+uint8_t read6502(uint16_t address)
+{
+	return fake6502_mem[address];
+}
+
+void write6502(uint16_t address, uint8_t value)
+{
+	fake6502_mem[address] = value;
+	journal_add(&fake6502_journal, address);
+}
+
+static struct my6502 my_cpu;
+
+static uint8_t my6502_read(void *user, uint16_t address)
+{
+	return my6502_mem[address];
+}
+
+static void my6502_write(void *user, uint16_t address, uint8_t value)
+{
+	my6502_mem[address] = value;
+	journal_add(&my6502_journal, address);
+}
+
+static const struct my6502_bus my6502_bus = {
+	.read = my6502_read,
+	.write = my6502_write,
+};
+
+static uint64_t rng;
+
+static uint64_t rand64(void)
+{
+	/* xorshift64* */
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545F4914F6CDD1Dull;
+}
+
+static unsigned int rand_below(unsigned int n)
+{
+	return (rand64() >> 32) % n;
+}
+
+/* Operands around page and sign boundaries hit most corner cases,
+ * e.g. a pointer at $FF or $xxFF. */
+static uint8_t rand_interesting(void)
+{
+	static const uint8_t values[] = {
+		0x00, 0x01, 0x02, 0x7E, 0x7F, 0x80, 0x81, 0xFE, 0xFF,
+	};
+
+	return values[rand_below(sizeof(values))];
+}
+
+static uint8_t rand_byte(void)
+{
+	return rand_below(4) ? rand64() >> 56 : rand_interesting();
+}
+
+static uint8_t opcodes[0x100];
+static unsigned int opcode_count;
+
+static uint8_t rand_opcode(void)
+{
+	return opcodes[rand_below(opcode_count)];
+}
+
+static void gen_code(uint8_t *code, unsigned int n)
+{
+	unsigned int i, j, size;
+
+	for (i = 0; i < n; i += size) {
+		code[i] = rand_opcode();
+		size = my6502_insn_size(code[i]);
+		for (j = 1; j < size && i + j < n; j++) {
+			code[i + j] = rand_byte();
+		}
+	}
+}
+
+static void gen_input(struct input *in)
+{
+	unsigned int i;
+
+	gen_code(in->code, CODE_SZ);
+	for (i = 0; i < 0x100; i++) {
+		in->zp[i] = rand_byte();
+		in->stack[i] = rand_byte();
+		in->data[i] = rand_byte();
+	}
+	in->pc_lo = rand_byte();
+	in->pc_hi = 2 + rand_below(0xFD);
+	in->ac = rand_byte();
+	in->x = rand_byte();
+	in->y = rand_byte();
+	in->sp = rand_byte();
+	in->sr = rand64() | 0x20;
+	in->data_page = rand_byte();
+}
+
+static void mutate(struct input *in)
+{
+	uint8_t *bytes = (uint8_t *)in;
+	unsigned int i = rand_below(CODE_SZ);
+
+	switch (rand_below(8)) {
+	case 0:
+		bytes[rand_below(sizeof(*in))] ^= 1 << rand_below(8);
+		break;
+	case 1:
+		bytes[rand_below(sizeof(*in))] = rand_interesting();
+		break;
+	case 2:
+		gen_code(in->code + i, CODE_SZ - i);
+		break;
+	case 3:
+		in->code[i] = rand_opcode();
+		break;
+	case 4:
+		in->code[i] = rand_interesting();
+		break;
+	case 5:
+		/* Code running across a page. */
+		in->pc_lo = 0xF0 + rand_below(0x10);
+		break;
+	case 6:
+		(&in->ac)[rand_below(4)] = rand_interesting();
+		break;
+	case 7:
+		in->sr ^= 1 << rand_below(8);
+		in->sr |= 0x20;
+		break;
+	}
+}
+
+static void lay(uint8_t *mem, const struct input *in)
+{
+	uint16_t start = in->pc_lo | in->pc_hi << 8;
+	unsigned int i;
+
+	memcpy(mem + (in->data_page << 8), in->data, 0x100);
+	memcpy(mem, in->zp, 0x100);
+	memcpy(mem + 0x100, in->stack, 0x100);
+	for (i = 0; i < CODE_SZ; i++) {
+		mem[(uint16_t)(start + i)] = in->code[i];
+	}
+}
+
+static void restore_journal(const struct journal *j)
+{
+	int i;
+
+	for (i = 0; i < j->len; i++) {
+		fake6502_mem[j->addresses[i]] = base[j->addresses[i]];
+		my6502_mem[j->addresses[i]] = base[j->addresses[i]];
+	}
+}
+
+static void unlay(const struct input *in)
+{
+	uint16_t start = in->pc_lo | in->pc_hi << 8;
+	unsigned int i, page = in->data_page << 8;
+
+	memcpy(fake6502_mem + page, base + page, 0x100);
+	memcpy(my6502_mem + page, base + page, 0x100);
+	memcpy(fake6502_mem, base, 0x200);
+	memcpy(my6502_mem, base, 0x200);
+	for (i = 0; i < CODE_SZ; i++) {
+		fake6502_mem[(uint16_t)(start + i)] = base[(uint16_t)(start + i)];
+		my6502_mem[(uint16_t)(start + i)] = base[(uint16_t)(start + i)];
+	}
+	restore_journal(&fake6502_journal);
+	restore_journal(&my6502_journal);
+}
+
+static void make_base(void)
+{
+	uint32_t h = 2166136261u;
+	unsigned int i;
+
+	/* Any fixed contents will do, but not a constant one so that
+	 * reads from the wrong address show. */
+	for (i = 0; i < sizeof(base); i++) {
+		h = (h ^ i) * 16777619u;
+		base[i] = h >> 24;
+	}
+	memcpy(fake6502_mem, base, sizeof(base));
+	memcpy(my6502_mem, base, sizeof(base));
+}
+
+static void init_cores(const struct input *in)
+{
+	pc = in->pc_lo | in->pc_hi << 8;
+	sp = in->sp;
+	a = in->ac;
+	x = in->x;
+	y = in->y;
+	/* The reference sets bit 5 at the next step. */
+	status = in->sr | 0x20;
+	clockticks6502 = 0;
+
+	my_cpu.pc = pc;
+	my_cpu.sp = sp;
+	my_cpu.ac = a;
+	my_cpu.x = x;
+	my_cpu.y = y;
+	my6502_set_sr(&my_cpu, status);
+	my_cpu.cycles = 0;
+	my_cpu.instructions = 0;
+
+	fake6502_journal.len = 0;
+	my6502_journal.len = 0;
+}
+
+static int cmp_journal(const struct journal *j)
+{
+	int i;
+
+	for (i = j->step; i < j->len; i++) {
+		if (fake6502_mem[j->addresses[i]] != my6502_mem[j->addresses[i]]) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int cmp_step(void)
+{
+	/* The reference sets bit 5 at the next step, e.g. after RTI. */
+	return pc != my_cpu.pc || sp != my_cpu.sp || a != my_cpu.ac
+		|| x != my_cpu.x || y != my_cpu.y
+		|| (status | 0x20) != my6502_get_sr(&my_cpu)
+		|| clockticks6502 != (uint32_t)my_cpu.cycles
+		|| cmp_journal(&fake6502_journal)
+		|| cmp_journal(&my6502_journal);
+}
+
+static void disasm_at(uint16_t address, char *buf, size_t size)
+{
+	uint8_t bytes[3];
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		bytes[i] = my6502_mem[(uint16_t)(address + i)];
+	}
+	my6502_disasm(address, bytes, buf, size);
+}
+
+static void dump_regs(void)
+{
+	printf("  . pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x"
+		" cycles=%u\n", pc, sp, a, x, y, status, clockticks6502);
+	printf("  ! pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x"
+		" cycles=%u\n", my_cpu.pc, my_cpu.sp, my_cpu.ac, my_cpu.x,
+		my_cpu.y, my6502_get_sr(&my_cpu), (uint32_t)my_cpu.cycles);
+}
+
+static void dump_writes(char who, const struct journal *j)
+{
+	int i;
+
+	for (i = j->step; i < j->len; i++) {
+		printf("  %c mem[%04x] . %02x ! %02x\n", who, j->addresses[i],
+			fake6502_mem[j->addresses[i]],
+			my6502_mem[j->addresses[i]]);
+	}
+}
+
+/* Run an input on both cores, reporting new outcomes to the shared
+ * coverage. Return the step that diverged, or zero. */
+static unsigned int run_input(const struct input *in, unsigned int steps,
+                              unsigned int *new_outcomes, int verbose)
+{
+	unsigned int step, extra, o, diverged = 0;
+	uint16_t at = 0;
+	uint8_t opcode = 0;
+	uint64_t cycles;
+	char dis[32];
+
+	lay(fake6502_mem, in);
+	lay(my6502_mem, in);
+	init_cores(in);
+
+	for (step = 1; step <= steps; step++) {
+		at = my_cpu.pc;
+		opcode = my6502_mem[at];
+		/* Both cores handle undocumented opcodes differently. */
+		if (!my6502_insn_size(opcode)) {
+			break;
+		}
+		if (verbose) {
+			disasm_at(at, dis, sizeof(dis));
+			printf("step %u %04x: %s\n", step, at, dis);
+		}
+
+		fake6502_journal.step = fake6502_journal.len;
+		my6502_journal.step = my6502_journal.len;
+		cycles = my_cpu.cycles;
+		step6502();
+		my6502_step(&my_cpu);
+
+		if (verbose) {
+			dump_regs();
+		}
+		if (cmp_step()) {
+			diverged = step;
+			break;
+		}
+
+		extra = my_cpu.cycles - cycles
+			- (my6502_insn_cycles(opcode) & ~MY6502_PAGE_CYCLE);
+		o = outcome(opcode, status, extra);
+		if (!shared->coverage[o]) {
+			shared->coverage[o] = 1;
+			(*new_outcomes)++;
+		}
+	}
+
+	if (diverged && (verbose || !shared->reported[opcode])) {
+		shared->reported[opcode] = 1;
+		disasm_at(at, dis, sizeof(dis));
+		printf("divergence at step %u, %04x: %s (%s)\n", diverged, at,
+			dis, mode_names[opcode]);
+		dump_regs();
+		dump_writes('.', &fake6502_journal);
+		dump_writes('!', &my6502_journal);
+		fflush(stdout);
+	}
+
+	unlay(in);
+	return diverged;
+}
+
+static const char *out_dir;
+
+static void save_input(const struct input *in, unsigned int worker,
+                       uint64_t n)
+{
+	char name[256];
+	FILE *f;
+
+	snprintf(name, sizeof(name), "%s/diverge-%u-%llu.in", out_dir,
+		worker, (unsigned long long)n);
+	f = fopen(name, "wb");
+	if (!f) {
+		perror(name);
+		return;
+	}
+	fwrite(in, sizeof(*in), 1, f);
+	fclose(f);
+	printf("saved %s\n", name);
+}
+
+/* Inputs reaching new outcomes. */
+#define CORPUS_SZ 4096
+
+static struct input corpus[CORPUS_SZ];
+static unsigned int corpus_len;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void work(unsigned int worker, uint64_t seed, uint64_t max_execs,
+                 double deadline, unsigned int steps)
+{
+	struct worker_stats *ws = &shared->workers[worker];
+	unsigned int new_outcomes, i, n;
+	struct input in;
+	uint64_t execs;
+
+	rng = seed + worker * 0x9E3779B97F4A7C15ull;
+	if (!rng) {
+		rng = 1;
+	}
+
+	for (execs = 0; !max_execs || execs < max_execs; execs++) {
+		if ((execs & 0x3FF) == 0) {
+			ws->execs = execs;
+			if (now() >= deadline) {
+				break;
+			}
+		}
+
+		if (!corpus_len || !rand_below(8)) {
+			gen_input(&in);
+		} else {
+			in = corpus[rand_below(corpus_len)];
+			n = 1 + rand_below(4);
+			for (i = 0; i < n; i++) {
+				mutate(&in);
+			}
+		}
+
+		new_outcomes = 0;
+		if (run_input(&in, steps, &new_outcomes, 0)) {
+			if (!ws->divergences++ && out_dir) {
+				save_input(&in, worker, execs);
+			}
+			continue;
+		}
+		if (new_outcomes) {
+			if (corpus_len < CORPUS_SZ) {
+				corpus[corpus_len++] = in;
+			} else {
+				corpus[rand_below(CORPUS_SZ)] = in;
+			}
+			ws->corpus = corpus_len;
+		}
+	}
+	ws->execs = execs;
+}
+
+static void print_coverage(void)
+{
+	unsigned int hit[0x100] = {0};
+	unsigned int i, total = 0, opcodes_hit = 0;
+	const char *modes[0x100];
+	unsigned int mode_hit[0x100] = {0}, mode_count = 0, m;
+
+	for (i = 0; i < OUTCOMES; i++) {
+		if (shared->coverage[i]) {
+			hit[i >> 6]++;
+			total++;
+		}
+	}
+
+	/* Per addressing mode, in table order. */
+	for (i = 0; i < 0x100; i++) {
+		if (!mode_names[i]) {
+			continue;
+		}
+		for (m = 0; m < mode_count; m++) {
+			if (!strcmp(modes[m], mode_names[i])) {
+				break;
+			}
+		}
+		if (m == mode_count) {
+			modes[mode_count++] = mode_names[i];
+		}
+		mode_hit[m] += hit[i];
+		opcodes_hit += hit[i] != 0;
+	}
+
+	printf("coverage: %u outcomes of %u opcodes, %u opcodes reached\n",
+		total, opcode_count, opcodes_hit);
+	for (m = 0; m < mode_count; m++) {
+		printf("  %-12s %u\n", modes[m], mode_hit[m]);
+	}
+}
+
+static void print_progress(unsigned int workers, double elapsed)
+{
+	uint64_t execs = 0, divergences = 0, corpus_total = 0;
+	unsigned int i, total = 0;
+
+	for (i = 0; i < workers; i++) {
+		execs += shared->workers[i].execs;
+		divergences += shared->workers[i].divergences;
+		corpus_total += shared->workers[i].corpus;
+	}
+	for (i = 0; i < OUTCOMES; i++) {
+		total += shared->coverage[i];
+	}
+
+	printf("%.0fs: %llu execs (%.0f/s), %u outcomes, corpus %llu,"
+		" %llu divergences\n", elapsed, (unsigned long long)execs,
+		elapsed > 0 ? execs / elapsed : 0, total,
+		(unsigned long long)corpus_total,
+		(unsigned long long)divergences);
+	fflush(stdout);
+}
+
+static int replay(const char *file_name, unsigned int steps)
+{
+	unsigned int new_outcomes = 0;
+	struct input in;
+	FILE *f;
+
+	f = fopen(file_name, "rb");
+	if (!f) {
+		perror(file_name);
+		return 1;
+	}
+	if (fread(&in, sizeof(in), 1, f) != 1) {
+		printf("%s: short input\n", file_name);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	if (!run_input(&in, steps, &new_outcomes, 1)) {
+		printf("no divergence\n");
+		return 0;
+	}
+	return 1;
+}
+
+static void usage(void)
+{
+	printf("Usage: %s [-j <workers>] [-t <seconds>] [-n <execs>]"
+		" [-k <steps>] [-s <seed>] [-o <dir>] [-r <input>]\n"
+		"  -j  worker processes, one per online CPU by default\n"
+		"  -t  stop after so many seconds, 10 by default\n"
+		"  -n  stop each worker after so many inputs\n"
+		"  -k  steps per input, 16 by default, up to %u\n"
+		"  -s  seed, 1 by default\n"
+		"  -o  save the first diverging input of each worker\n"
+		"  -r  replay a saved input step by step\n", getprogname(),
+		MAX_STEPS);
+}
+
+int main(int argc, char *argv[])
+{
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t max_execs = 0, seed = 1, divergences = 0;
+	unsigned int steps = 16, i;
+	const char *replay_name = NULL;
+	double seconds = 10, start, deadline;
+	int opt, status_code, running;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "j:t:n:k:s:o:r:")) != -1) {
+		switch (opt) {
+		case 'j':
+			workers = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'n':
+			max_execs = strtoull(optarg, NULL, 0);
+			break;
+		case 'k':
+			steps = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_dir = optarg;
+			break;
+		case 'r':
+			replay_name = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc != optind || workers < 1 || !steps || steps > MAX_STEPS) {
+		usage();
+		return 1;
+	}
+
+	for (i = 0; i < 0x100; i++) {
+		if (my6502_insn_size(i)) {
+			opcodes[opcode_count++] = i;
+		}
+	}
+
+	shared = mmap(NULL, sizeof(*shared)
+		+ workers * sizeof(shared->workers[0]), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(shared != MAP_FAILED);
+
+	make_base();
+	my6502_init(&my_cpu, &my6502_bus, NULL);
+	/* Read the memory directly. Writes still go through my6502_write()
+	 * to be journaled. */
+	my6502_map(&my_cpu, 0, sizeof(my6502_mem), my6502_mem,
+		MY6502_MAP_READ);
+	my6502_reset(&my_cpu, 0);
+
+	if (replay_name) {
+		return replay(replay_name, steps);
+	}
+
+	printf("%ld workers, seed %llu, %u steps per input\n", workers,
+		(unsigned long long)seed, steps);
+	fflush(stdout);
+
+	start = now();
+	deadline = start + seconds;
+	for (i = 0; i < workers; i++) {
+		pid = fork();
+		assert(pid >= 0);
+		if (!pid) {
+			work(i, seed, max_execs, deadline, steps);
+			_exit(0);
+		}
+	}
+
+	for (running = workers; running; ) {
+		sleep(1);
+		while ((pid = waitpid(-1, &status_code, WNOHANG)) > 0) {
+			running--;
+		}
+		print_progress(workers, now() - start);
+	}
+
+	print_coverage();
+	for (i = 0; i < workers; i++) {
+		divergences += shared->workers[i].divergences;
+	}
+
+	return divergences != 0;
+}
@@ -1,5 +1,9 @@
 #include <assert.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,21 +12,58 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "my6502.h"
+#include "trace.h"
+
 /* Reference implementation. */
 extern void reset6502();
 extern void step6502();
 
 extern uint16_t pc;
 extern uint8_t sp, a, x, y, status;
+extern uint32_t clockticks6502;
+
+/* Memory of each core, a private mapping of the ROM file. See
+ * load_memory(). */
+#define MEM_SZ 0x10000
+
+static uint8_t *fake6502_mem;
+
+/* Addresses written by a core during the current step. Memory is
+ * known to match before the step, so only these may have diverged.
+ * There is one per core as the cores may run on separate threads. */
+#define JOURNAL_SZ 16
+
+struct journal {
+	uint16_t addresses[JOURNAL_SZ];
+	int len;
+};
 
-static uint8_t fake6502_mem[0x10000];
+static struct journal fake6502_journal;
+static struct journal my6502_journal;
 
-#if 0
+/* Compare the whole memory every so often regardless of the journal,
+ * and take a snapshot at that point if asked to. */
+static unsigned long checkpoint_steps = 1000000;
+
+#define VERBOSE 0
+
+#if VERBOSE
 #define my_printf printf
 #else
 #define my_printf(...)
 #endif
 
+static void journal_add(struct journal *j, uint16_t address)
+{
+	/* Overflowing entries are dropped, cmp_mem() falls back to
+	 * the full compare then. */
+	if (j->len < JOURNAL_SZ) {
+		j->addresses[j->len] = address;
+	}
+	j->len++;
+}
+
 uint8_t read6502(uint16_t address)
 {
 	uint8_t value = fake6502_mem[address];
@@ -35,24 +76,20 @@ void write6502(uint16_t address, uint8_t value)
 {
 	my_printf(". wr(%04x) = %02x\n", address, value);
 	fake6502_mem[address] = value;
+	journal_add(&fake6502_journal, address);
 }
 
 static void dump_fake6502_reg(void)
 {
-	my_printf(". pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x\n",
-		pc, sp, a, x, y, status);
+	my_printf(". pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x"
+		" cycles=%u\n", pc, sp, a, x, y, status, clockticks6502);
 }
 
 /* My implementation. */
-extern void my6502_reset(uint16_t pc);
-extern void my6502_step(void);
-
-extern uint16_t my_pc;
-extern uint8_t my_ac, my_x, my_y, my_sr, my_sp;
-
-static uint8_t my6502_mem[0x10000];
+static struct my6502 my_cpu;
+static uint8_t *my6502_mem;
 
-uint8_t my6502_read(uint16_t address)
+static uint8_t my6502_read(void *user, uint16_t address)
 {
 	uint8_t value = my6502_mem[address];
 
@@ -60,63 +97,916 @@ uint8_t my6502_read(uint16_t address)
 	return value;
 }
 
-void my6502_write(uint16_t address, uint8_t value)
+static void my6502_write(void *user, uint16_t address, uint8_t value)
 {
 	my_printf("! wr(%04x) = %02x\n", address, value);
 	my6502_mem[address] = value;
+	journal_add(&my6502_journal, address);
 }
 
+static const struct my6502_bus my6502_bus = {
+	.read = my6502_read,
+	.write = my6502_write,
+};
+
 static void dump_my6502_reg(void)
 {
-	my_printf("! pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x\n",
-		my_pc, my_sp, my_ac, my_x, my_y, my_sr);
+	my_printf("! pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x"
+		" cycles=%u\n", my_cpu.pc, my_cpu.sp, my_cpu.ac, my_cpu.x,
+		my_cpu.y, my6502_get_sr(&my_cpu), (uint32_t)my_cpu.cycles);
+}
+
+/* Memory as loaded, snapshots only store the pages that differ. */
+static const uint8_t *rom;
+
+/* Map a bank of the file privately: pages are read in on the first
+ * access and copied on the first write. Past the end of the file the
+ * bank reads as zeroes. */
+static uint8_t *map_bank(int fd, off_t file_sz, unsigned int bank, int prot)
+{
+	off_t offset = (off_t)bank * MEM_SZ;
+	size_t len = file_sz - offset < MEM_SZ ? file_sz - offset : MEM_SZ;
+	void *p;
+
+	p = mmap(NULL, MEM_SZ, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(p != MAP_FAILED);
+	p = mmap(p, len, prot, MAP_PRIVATE | MAP_FIXED, fd, offset);
+	assert(p != MAP_FAILED);
+
+	return p;
 }
 
-static void load_memory(const char *file_name, uint8_t *mem, size_t mem_sz)
+/* A file larger than 64 KiB holds a memory image per bank, e.g. of a
+ * bank-switched cart. Only the chosen one is mapped, and nothing is
+ * copied: both cores start from the ROM and copy the pages they write. */
+static void load_memory(const char *file_name, unsigned int bank)
 {
+	unsigned int banks;
 	struct stat s;
 	int fd, rc;
-	void *p;
 
 	fd = open(file_name, O_RDONLY);
 	assert(fd >= 0);
 
 	rc = fstat(fd, &s);
 	assert(rc == 0);
-	assert(s.st_size <= mem_sz);
+	banks = (s.st_size + MEM_SZ - 1) / MEM_SZ;
+	if (bank >= banks) {
+		printf("%s has %u banks\n", file_name, banks);
+		exit(1);
+	}
+
+	rom = map_bank(fd, s.st_size, bank, PROT_READ);
+	fake6502_mem = map_bank(fd, s.st_size, bank, PROT_READ | PROT_WRITE);
+	my6502_mem = map_bank(fd, s.st_size, bank, PROT_READ | PROT_WRITE);
+	close(fd);
+
+	printf("loaded %lld bytes, bank %u of %u\n", (long long)s.st_size,
+		bank, banks);
+}
+
+/* Trace steps of either core. Fetch the instruction before the step,
+ * it may overwrite itself. */
+static void trace_begin(struct trace_record *r, const uint8_t *mem,
+                        uint16_t pc)
+{
+	memset(r, 0, sizeof(*r));
+	r->pc = pc;
+	r->opcode = mem[pc];
+	r->operand[0] = mem[(uint16_t)(pc + 1)];
+	r->operand[1] = mem[(uint16_t)(pc + 2)];
+	r->size = my6502_insn_size(r->opcode);
+}
+
+/* Complete the record with the writes of the step. */
+static void trace_writes(struct trace_record *r, const uint8_t *mem,
+                         const struct journal *j)
+{
+	int i;
+
+	r->write_count = j->len;
+	for (i = 0; i < TRACE_WRITES && i < j->len && i < JOURNAL_SZ; i++) {
+		r->write_address[i] = j->addresses[i];
+		r->write_value[i] = mem[j->addresses[i]];
+	}
+}
+
+static void trace_my6502_reg(struct trace_record *r)
+{
+	r->cycles = my_cpu.cycles;
+	r->ac = my_cpu.ac;
+	r->x = my_cpu.x;
+	r->y = my_cpu.y;
+	r->sp = my_cpu.sp;
+	r->sr = my6502_get_sr(&my_cpu);
+	r->next_pc = my_cpu.pc;
+}
+
+static void trace_fake6502_reg(struct trace_record *r)
+{
+	r->cycles = clockticks6502;
+	r->ac = a;
+	r->x = x;
+	r->y = y;
+	r->sp = sp;
+	r->sr = status;
+	r->next_pc = pc;
+}
+
+static void dump_record(char who, const struct trace_record *r)
+{
+	int i;
+
+	for (i = 0; i < r->write_count && i < TRACE_WRITES; i++) {
+		printf("%c wr(%04x) = %02x\n", who, r->write_address[i],
+			r->write_value[i]);
+	}
+	printf("%c pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x"
+		" cycles=%u\n", who, r->next_pc, r->sp, r->ac, r->x, r->y,
+		r->sr, (uint32_t)r->cycles);
+}
+
+/* Run the reference alone until it traps, recording every step. */
+static int record_golden(const char *file_name)
+{
+	struct trace_record r;
+	struct trace *t;
+	uint64_t i = 0;
+
+	t = trace_open(file_name);
+	if (!t) {
+		printf("can't create %s\n", file_name);
+		return 1;
+	}
+
+	do {
+		trace_begin(&r, fake6502_mem, pc);
+		step6502();
+		trace_fake6502_reg(&r);
+		trace_writes(&r, fake6502_mem, &fake6502_journal);
+		trace_add(t, &r);
+		fake6502_journal.len = 0;
+		++i;
+	} while (pc != r.pc);
+
+	if (trace_close(t)) {
+		printf("failed to write %s\n", file_name);
+		return 1;
+	}
+
+	printf("recorded %llu steps, stopped at pc=0x%4x\n",
+		(unsigned long long)i, pc);
+	return 0;
+}
+
+/* Compare a step of my6502 to the golden record. The registers and
+ * the cycles must match, and so must the set of written addresses and
+ * their values after the step, which keeps the memories identical
+ * without the reference one. */
+static int cmp_record(const struct trace_record *golden,
+                      const struct trace_record *r)
+{
+	int i, j;
+
+	if (golden->next_pc != r->next_pc || golden->sp != r->sp
+		|| golden->ac != r->ac || golden->x != r->x
+		|| golden->y != r->y || golden->sr != r->sr
+		|| (uint32_t)golden->cycles != (uint32_t)r->cycles
+		|| golden->write_count != r->write_count) {
+		return 1;
+	}
+
+	for (i = 0; i < golden->write_count && i < TRACE_WRITES; i++) {
+		if (my6502_mem[golden->write_address[i]]
+			!= golden->write_value[i]) {
+			return 1;
+		}
+		for (j = 0; j < r->write_count && j < TRACE_WRITES; j++) {
+			if (r->write_address[j] == golden->write_address[i]) {
+				break;
+			}
+		}
+		if (j == r->write_count || j == TRACE_WRITES) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Run a step of my6502 and compare it to the golden record. */
+static int check_step(const struct trace_record *golden, uint64_t step,
+                      enum my6502_stop *stop)
+{
+	struct trace_record r;
+
+	if (golden->pc != my_cpu.pc) {
+		printf("! step %llu at pc=%04x, recorded at pc=%04x\n",
+			(unsigned long long)step, my_cpu.pc, golden->pc);
+		return 1;
+	}
+
+	trace_begin(&r, my6502_mem, my_cpu.pc);
+	*stop = my6502_run(&my_cpu, 1);
+	trace_my6502_reg(&r);
+	trace_writes(&r, my6502_mem, &my6502_journal);
+	my6502_journal.len = 0;
+
+	if (cmp_record(golden, &r)) {
+		printf("! mismatch at step %llu, pc=%04x\n",
+			(unsigned long long)step, golden->pc);
+		dump_record('.', golden);
+		dump_record('!', &r);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Run my6502 alone against a trace recorded by record_golden(). */
+static int verify_golden(const char *file_name)
+{
+	const struct trace_header *header;
+	const struct trace_record *golden;
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	uint64_t i, count;
+	struct stat s;
+	void *p;
+	int fd;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd >= 0 && fstat(fd, &s)) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		printf("can't open %s\n", file_name);
+		return 1;
+	}
 
 	p = mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	assert(p != MAP_FAILED);
+	close(fd);
+	header = p;
+	if (p == MAP_FAILED || s.st_size < sizeof(*header)
+		|| header->magic != TRACE_MAGIC
+		|| header->version != TRACE_VERSION
+		|| header->record_size != sizeof(*golden)) {
+		if (p != MAP_FAILED) {
+			munmap(p, s.st_size);
+		}
+		printf("%s is not a trace\n", file_name);
+		return 1;
+	}
+	golden = (const struct trace_record *)(header + 1);
+	count = (s.st_size - sizeof(*header)) / sizeof(*golden);
+	madvise(p, s.st_size, MADV_SEQUENTIAL);
+
+	for (i = 0; i < count; i++) {
+		if (check_step(&golden[i], i + 1, &stop)) {
+			return 1;
+		}
+
+		if (stop == MY6502_STOP_TRAP && i + 1 != count) {
+			printf("! trapped at step %llu of %llu\n",
+				(unsigned long long)i + 1, (unsigned long long)count);
+			return 1;
+		}
+	}
 
-	memcpy(mem, p, s.st_size);
+	if (!count || stop != MY6502_STOP_TRAP) {
+		printf("! trace ended at pc=%04x without a trap\n", my_cpu.pc);
+		return 1;
+	}
 
+	printf("verified %llu steps, stopped at pc=0x%4x\n",
+		(unsigned long long)count, my_cpu.pc);
 	munmap(p, s.st_size);
-	close(fd);
+	return 0;
+}
+
+/* Steps of the reference running ahead on its own thread, passed
+ * to the my6502 thread through a single producer single consumer
+ * ring. */
+#define RING_SZ 4096
+
+static struct trace_record ring[RING_SZ];
+/* Records pushed and popped so far, only written by the producer and
+ * the consumer respectively. */
+static _Atomic uint64_t ring_head;
+static _Atomic uint64_t ring_tail;
+/* Set by the consumer to stop the producer early. */
+static atomic_int ring_abort;
+
+static void *reference_thread(void *arg)
+{
+	struct trace_record *r;
+	uint64_t head = 0;
+
+	do {
+		while (head - atomic_load_explicit(&ring_tail,
+			memory_order_acquire) == RING_SZ) {
+			sched_yield();
+			if (atomic_load_explicit(&ring_abort,
+				memory_order_relaxed)) {
+				return NULL;
+			}
+		}
+		if (atomic_load_explicit(&ring_abort, memory_order_relaxed)) {
+			break;
+		}
+
+		r = &ring[head % RING_SZ];
+		trace_begin(r, fake6502_mem, pc);
+		step6502();
+		trace_fake6502_reg(r);
+		trace_writes(r, fake6502_mem, &fake6502_journal);
+		fake6502_journal.len = 0;
+
+		atomic_store_explicit(&ring_head, ++head, memory_order_release);
+	} while (pc != r->pc);
+
+	return NULL;
+}
+
+/* Run the reference on another thread and check my6502 against its
+ * records. Memory is checked through the write sets as when verifying
+ * a golden trace, the threads never share it. */
+static int run_parallel(uint64_t i)
+{
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	pthread_t thread;
+	uint64_t tail = 0;
+	int rc = 0;
+
+	if (pthread_create(&thread, NULL, reference_thread, NULL)) {
+		printf("can't start the reference thread\n");
+		return 1;
+	}
+
+	do {
+		while (tail == atomic_load_explicit(&ring_head,
+			memory_order_acquire)) {
+			sched_yield();
+		}
+
+		if (check_step(&ring[tail % RING_SZ], i, &stop)) {
+			rc = 1;
+			break;
+		}
+
+		atomic_store_explicit(&ring_tail, ++tail, memory_order_release);
+		++i;
+	} while (stop != MY6502_STOP_TRAP);
+
+	/* The reference traps at the same step unless there was
+	 * a mismatch. */
+	atomic_store_explicit(&ring_abort, 1, memory_order_relaxed);
+	pthread_join(thread, NULL);
+
+	if (!rc) {
+		printf("stopped at pc=0x%4x\n", my_cpu.pc);
+	}
+	return rc;
+}
+
+/* Snapshot file is the header followed by page_count pages, each one
+ * being the page number and 256 bytes. Memory of both cores is known to
+ * match at a checkpoint, so it is stored once. The layout is the host
+ * one, snapshots are meant to be resumed on the same machine. */
+#define SNAPSHOT_MAGIC 0x53353659 /* "Y65S" */
+
+struct snapshot {
+	uint32_t magic;
+	uint32_t rom_hash;
+	uint64_t step;
+
+	/* Reference implementation. */
+	uint16_t pc;
+	uint8_t sp, a, x, y, status;
+	uint32_t clockticks;
+
+	/* My implementation. */
+	uint16_t my_pc;
+	uint8_t my_sp, my_ac, my_x, my_y, my_sr;
+	uint64_t my_cycles;
+	uint64_t my_instructions;
+
+	uint16_t page_count;
+};
+
+static uint32_t hash_rom(void)
+{
+	/* FNV-1a. */
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < MEM_SZ; i++) {
+		h = (h ^ rom[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+/* Registers of both cores, memory is up to the caller. */
+static void snapshot_take(struct snapshot *snap, uint64_t step)
+{
+	*snap = (struct snapshot){
+		.magic = SNAPSHOT_MAGIC,
+		.rom_hash = hash_rom(),
+		.step = step,
+		.pc = pc, .sp = sp, .a = a, .x = x, .y = y, .status = status,
+		.clockticks = clockticks6502,
+		.my_pc = my_cpu.pc, .my_sp = my_cpu.sp, .my_ac = my_cpu.ac,
+		.my_x = my_cpu.x, .my_y = my_cpu.y,
+		.my_sr = my6502_get_sr(&my_cpu),
+		.my_cycles = my_cpu.cycles,
+		.my_instructions = my_cpu.instructions,
+	};
+}
+
+static void snapshot_restore(const struct snapshot *snap)
+{
+	pc = snap->pc;
+	sp = snap->sp;
+	a = snap->a;
+	x = snap->x;
+	y = snap->y;
+	status = snap->status;
+	clockticks6502 = snap->clockticks;
+
+	my_cpu.pc = snap->my_pc;
+	my_cpu.sp = snap->my_sp;
+	my_cpu.ac = snap->my_ac;
+	my_cpu.x = snap->my_x;
+	my_cpu.y = snap->my_y;
+	my6502_set_sr(&my_cpu, snap->my_sr);
+	my_cpu.cycles = snap->my_cycles;
+	my_cpu.instructions = snap->my_instructions;
+}
+
+static void save_snapshot(const char *file_name, uint64_t step)
+{
+	struct snapshot snap;
+	char tmp_name[PATH_MAX];
+	uint8_t page;
+	FILE *f;
+	int i;
+
+	snapshot_take(&snap, step);
+	for (i = 0; i < 0x100; i++) {
+		if (memcmp(rom + i * 0x100, fake6502_mem + i * 0x100, 0x100)) {
+			snap.page_count++;
+		}
+	}
+
+	/* Never leave a torn snapshot behind. */
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+	f = fopen(tmp_name, "wb");
+	assert(f);
+
+	fwrite(&snap, sizeof(snap), 1, f);
+	for (i = 0; i < 0x100; i++) {
+		if (memcmp(rom + i * 0x100, fake6502_mem + i * 0x100, 0x100)) {
+			page = i;
+			fwrite(&page, 1, 1, f);
+			fwrite(fake6502_mem + i * 0x100, 0x100, 1, f);
+		}
+	}
+
+	if (fclose(f) || rename(tmp_name, file_name)) {
+		printf("failed to save %s\n", file_name);
+		exit(1);
+	}
+
+	my_printf("saved step %llu with %u pages\n",
+		(unsigned long long)step, snap.page_count);
+}
+
+/* Restore both cores, return the number of steps done. */
+static uint64_t load_snapshot(const char *file_name)
+{
+	struct snapshot snap;
+	uint8_t page;
+	FILE *f;
+	int i;
+
+	f = fopen(file_name, "rb");
+	assert(f);
+
+	if (fread(&snap, sizeof(snap), 1, f) != 1
+		|| snap.magic != SNAPSHOT_MAGIC) {
+		printf("%s is not a snapshot\n", file_name);
+		exit(1);
+	}
+	if (snap.rom_hash != hash_rom()) {
+		printf("%s is for another rom\n", file_name);
+		exit(1);
+	}
 
-	printf("loaded %lld bytes\n", s.st_size);
+	memcpy(fake6502_mem, rom, MEM_SZ);
+	for (i = 0; i < snap.page_count; i++) {
+		if (fread(&page, 1, 1, f) != 1
+			|| fread(fake6502_mem + page * 0x100, 0x100, 1, f) != 1) {
+			printf("%s is truncated\n", file_name);
+			exit(1);
+		}
+	}
+	memcpy(my6502_mem, fake6502_mem, MEM_SZ);
+	fclose(f);
+
+	snapshot_restore(&snap);
+	return snap.step;
 }
 
 static int cmp_reg(void)
 {
-	return (pc != my_pc || sp != my_sp || a != my_ac
-		|| x != my_x || y != my_y || status != my_sr);
+	/* The reference counts cycles in 32 bits. */
+	return (pc != my_cpu.pc || sp != my_cpu.sp || a != my_cpu.ac
+		|| x != my_cpu.x || y != my_cpu.y || status != my6502_get_sr(&my_cpu)
+		|| clockticks6502 != (uint32_t)my_cpu.cycles);
+}
+
+static int cmp_journal(const struct journal *j)
+{
+	int i;
+
+	for (i = 0; i < j->len; i++) {
+		if (fake6502_mem[j->addresses[i]] != my6502_mem[j->addresses[i]]) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int cmp_mem(int full)
+{
+	if (full || fake6502_journal.len > JOURNAL_SZ
+		|| my6502_journal.len > JOURNAL_SZ) {
+		return memcmp(fake6502_mem, my6502_mem, MEM_SZ);
+	}
+
+	return cmp_journal(&fake6502_journal) || cmp_journal(&my6502_journal);
+}
+
+/* Also drops cached blocks once my6502_mem is replaced. */
+static void map_my6502_mem(void)
+{
+#if !VERBOSE
+	/* Read the memory directly. Writes still go through my6502_write()
+	 * to be journaled. */
+	my6502_map(&my_cpu, 0, MEM_SZ, my6502_mem,
+		MY6502_MAP_READ);
+#endif
+}
+
+/* Bisection keeps the last checkpoint where both cores matched. */
+struct checkpoint {
+	struct snapshot snap;
+	uint8_t mem[MEM_SZ];
+};
+
+/* Steps left to single-step with every check on. */
+#define BISECT_WINDOW 64
+
+static void checkpoint_take(struct checkpoint *c, uint64_t step)
+{
+	snapshot_take(&c->snap, step);
+	memcpy(c->mem, fake6502_mem, MEM_SZ);
+}
+
+static void checkpoint_restore(const struct checkpoint *c)
+{
+	snapshot_restore(&c->snap);
+	memcpy(fake6502_mem, c->mem, MEM_SZ);
+	memcpy(my6502_mem, c->mem, MEM_SZ);
+	map_my6502_mem();
+}
+
+/* Run both cores without checks for up to n steps, my6502 a whole run
+ * at a time. Return the number of steps, fewer if my6502 trapped. */
+static uint64_t run_unchecked(uint64_t n, enum my6502_stop *stop)
+{
+	uint64_t done = my_cpu.instructions;
+	uint64_t i;
+
+	*stop = my6502_run(&my_cpu, n);
+	done = my_cpu.instructions - done;
+	for (i = 0; i < done; i++) {
+		step6502();
+	}
+	fake6502_journal.len = 0;
+	my6502_journal.len = 0;
+
+	return done;
+}
+
+static int cmp_state(void)
+{
+	return cmp_reg() || cmp_mem(1);
+}
+
+static void dump_mem_delta(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < MEM_SZ; i++) {
+		if (fake6502_mem[i] != my6502_mem[i]) {
+			if (n++ < 16) {
+				printf("  mem[%04x] . %02x ! %02x\n", i,
+					fake6502_mem[i], my6502_mem[i]);
+			}
+		}
+	}
+	if (n > 16) {
+		printf("  %d more bytes differ\n", n - 16);
+	}
+}
+
+/* Single-step from the checkpoint with everything compared after every
+ * step and report the first step that diverges. */
+static int bisect_window(const struct checkpoint *good, uint64_t last)
+{
+	struct trace_record fake_r, my_r;
+	enum my6502_stop stop;
+	uint64_t step;
+	uint8_t bytes[3];
+	char dis[32];
+	int i;
+
+	checkpoint_restore(good);
+	for (step = good->snap.step + 1; step <= last; step++) {
+		/* The instruction may wrap around the end of memory. */
+		for (i = 0; i < 3; i++) {
+			bytes[i] = my6502_mem[(uint16_t)(my_cpu.pc + i)];
+		}
+		my6502_disasm(my_cpu.pc, bytes, dis, sizeof(dis));
+		printf("step %llu %04x: %s\n", (unsigned long long)step,
+			my_cpu.pc, dis);
+
+		trace_begin(&fake_r, fake6502_mem, pc);
+		step6502();
+		trace_fake6502_reg(&fake_r);
+		trace_writes(&fake_r, fake6502_mem, &fake6502_journal);
+
+		trace_begin(&my_r, my6502_mem, my_cpu.pc);
+		stop = my6502_run(&my_cpu, 1);
+		trace_my6502_reg(&my_r);
+		trace_writes(&my_r, my6502_mem, &my6502_journal);
+
+		fake6502_journal.len = 0;
+		my6502_journal.len = 0;
+
+		dump_record('.', &fake_r);
+		dump_record('!', &my_r);
+
+		if (cmp_state()) {
+			printf("! first divergence at step %llu, %04x: %s\n",
+				(unsigned long long)step, my_r.pc, dis);
+			dump_mem_delta();
+			return 1;
+		}
+
+		if (stop == MY6502_STOP_TRAP) {
+			break;
+		}
+	}
+
+	printf("! divergence not reproduced\n");
+	return 1;
+}
+
+/* Compare the cores at checkpoints only, and only on a mismatch narrow
+ * it down to the exact step by replaying from the last good one. */
+static int run_bisect(uint64_t i)
+{
+	static struct checkpoint good;
+	enum my6502_stop stop;
+	uint64_t lo, hi, mid;
+
+	/* Steps done so far, i is the next one. */
+	checkpoint_take(&good, i - 1);
+	for (;;) {
+		i += run_unchecked(checkpoint_steps, &stop);
+		printf("step %llu\n", (unsigned long long)i - 1);
+		if (cmp_state()) {
+			break;
+		}
+		if (stop == MY6502_STOP_TRAP) {
+			printf("stopped at pc=0x%4x\n", my_cpu.pc);
+			return 0;
+		}
+		checkpoint_take(&good, i - 1);
+	}
+
+	/* Good after lo steps, bad after hi steps. */
+	lo = good.snap.step;
+	hi = i - 1;
+	printf("! mismatch between steps %llu and %llu\n",
+		(unsigned long long)lo + 1, (unsigned long long)hi);
+
+	while (hi - lo > BISECT_WINDOW) {
+		mid = lo + (hi - lo) / 2;
+		checkpoint_restore(&good);
+		run_unchecked(mid - lo, &stop);
+		if (cmp_state()) {
+			hi = mid;
+		} else {
+			lo = mid;
+			checkpoint_take(&good, mid);
+		}
+	}
+
+	return bisect_window(&good, hi);
+}
+
+/* Progress of my6502, reported from a thread of its own so that the
+ * run loops don't do any I/O. See -m and -M. */
+static struct my6502_metrics metrics;
+static unsigned int metrics_period;
+static const char *metrics_name;
+
+static void write_metrics(const char *buf)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+
+	/* Replace the file as a whole for whoever scrapes it. */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_name);
+	f = fopen(tmp, "w");
+	if (!f) {
+		return;
+	}
+	fputs(buf, f);
+	if (fclose(f) == 0) {
+		rename(tmp, metrics_name);
+	}
+}
+
+static void *metrics_thread(void *arg)
+{
+	char buf[1024];
+
+	for (;;) {
+		sleep(metrics_period);
+		if (metrics_name) {
+			my6502_metrics_prometheus(&metrics, "my6502", buf,
+				sizeof(buf));
+			write_metrics(buf);
+		} else {
+			my6502_metrics_json(&metrics, "my6502", buf,
+				sizeof(buf));
+			fputs(buf, stderr);
+		}
+	}
+
+	return NULL;
+}
+
+static int start_metrics(void)
+{
+	pthread_t thread;
+
+	my6502_set_metrics(&my_cpu, &metrics);
+	if (pthread_create(&thread, NULL, metrics_thread, NULL)) {
+		return -1;
+	}
+
+	return pthread_detach(thread);
+}
+
+#ifdef MY6502_STATS
+static void dump_stats(void)
+{
+	my6502_dump_stats(&my_cpu, stdout);
+}
+#endif
+
+static void usage(void)
+{
+	printf("Usage: %s [-b] [-j] [-c <steps>] [-s <file>] [-r <file>]"
+		" [-t <file>]\n"
+		"       [-k <bank>] [-m <seconds> [-M <file>]]"
+		" [-g <file> | -v <file> | -p | -d]\n"
+		"       <rom.bin>\n"
+		"  -b  run my6502 with the block cache\n"
+		"  -j  compile every block, implies -b\n"
+		"  -c  steps between checkpoints, 1000000 by default\n"
+		"  -s  save a snapshot to a file at every checkpoint\n"
+		"  -r  resume from a snapshot\n"
+		"  -t  write a binary trace of my6502, see trace_dump.elf\n"
+		"  -g  record a golden trace running the reference alone\n"
+		"  -v  verify my6502 alone against a golden trace\n"
+		"  -p  run the reference ahead on another thread\n"
+		"  -d  compare at checkpoints only, bisect a mismatch\n"
+		"  -k  start from a 64 KiB bank of the file, 0 by default\n"
+		"  -m  print the metrics of my6502 to stderr as a JSON line"
+		" every so often\n"
+		"  -M  write them to a file as Prometheus text instead\n",
+		getprogname());
 }
 
 int main(int argc, char *argv[])
 {
-	int i = 1;
-	uint16_t last_pc;
+	uint64_t i = 1;
+	unsigned int bank = 0;
+	int block_cache = 0;
+	int jit = 0;
+	const char *save_name = NULL;
+	const char *resume_name = NULL;
+	const char *golden_name = NULL;
+	const char *verify_name = NULL;
+	const char *trace_name = NULL;
+	int parallel = 0;
+	int bisect = 0;
+	struct trace *trace = NULL;
+	struct trace_record record;
+	int rc = 0;
+	int opt;
+	enum my6502_stop stop;
+
+	while ((opt = getopt(argc, argv, "bjc:s:r:t:g:v:pdk:m:M:")) != -1) {
+		switch (opt) {
+		case 'b':
+			block_cache = 1;
+			break;
+		case 'j':
+			block_cache = 1;
+			jit = 1;
+			break;
+		case 'c':
+			checkpoint_steps = strtoul(optarg, NULL, 0);
+			if (!checkpoint_steps) {
+				usage();
+				return 1;
+			}
+			break;
+		case 's':
+			save_name = optarg;
+			break;
+		case 'r':
+			resume_name = optarg;
+			break;
+		case 't':
+			trace_name = optarg;
+			break;
+		case 'g':
+			golden_name = optarg;
+			break;
+		case 'v':
+			verify_name = optarg;
+			break;
+		case 'p':
+			parallel = 1;
+			break;
+		case 'd':
+			bisect = 1;
+			break;
+		case 'k':
+			bank = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			metrics_period = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			metrics_name = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
 
-	if (argc != 2) {
-		printf("Usage: %s <rom.bin>\n", getprogname());
+	if (argc - optind != 1
+		|| (!!golden_name + !!verify_name + parallel + bisect > 1)
+		|| ((parallel || bisect) && (save_name || trace_name))
+		|| (metrics_name && !metrics_period)) {
+		usage();
 		return 1;
 	}
 
-	load_memory(argv[1], fake6502_mem, sizeof(fake6502_mem));
-	memcpy(my6502_mem, fake6502_mem, sizeof(my6502_mem));
+	load_memory(argv[optind], bank);
 
 	reset6502();
-	my6502_reset(0x400);
+	my6502_init(&my_cpu, &my6502_bus, NULL);
+#ifdef MY6502_STATS
+	/* Whatever mode the run ends in. */
+	atexit(dump_stats);
+#endif
+	map_my6502_mem();
+	my6502_reset(&my_cpu, 0x400);
+	if (block_cache && my6502_block_cache(&my_cpu, 1)) {
+		printf("out of memory\n");
+		return 1;
+	}
+	if (jit && my6502_jit(&my_cpu, 1)) {
+		printf("no jit\n");
+		return 1;
+	}
+	if (metrics_period && start_metrics()) {
+		printf("can't start the metrics thread\n");
+		return 1;
+	}
 
 	/* Altering PC to run functional tests.
 	 * See:
@@ -125,40 +1015,89 @@ int main(int argc, char *argv[])
 	pc = 0x400;
 	printf("altered reference pc\n");
 
-	/* We're in a trap if PC doesn't change, i.e. "jmp *" */
-	last_pc = ~0x400;
+	if (golden_name) {
+		return record_golden(golden_name);
+	}
+	if (verify_name) {
+		return verify_golden(verify_name);
+	}
 
-	dump_fake6502_reg();
-	dump_my6502_reg();
-	while (my_pc != last_pc)
-	{
-		if (i % 1000000) {
-			my_printf("step %d\n", i);
-		} else {
-			/* Report on significant progress regardless of verbosity. */
-			printf("step %d\n", i);
+	if (trace_name) {
+		trace = trace_open(trace_name);
+		if (!trace) {
+			printf("can't create %s\n", trace_name);
+			return 1;
 		}
+	}
+
+	/* Nothing has run yet, so there are no cached blocks to drop
+	 * after replacing the memory. */
+	if (resume_name) {
+		i = load_snapshot(resume_name) + 1;
+		printf("resumed at step %llu\n", (unsigned long long)i);
+	}
+
+	if (parallel) {
+		return run_parallel(i);
+	}
+	if (bisect) {
+		return run_bisect(i);
+	}
 
-		last_pc = my_pc;
+	dump_fake6502_reg();
+	dump_my6502_reg();
+	do {
+		my_printf("step %llu\n", (unsigned long long)i);
 
 		step6502();
-		my6502_step();
+		if (trace) {
+			trace_begin(&record, my6502_mem, my_cpu.pc);
+		}
+		stop = my6502_run(&my_cpu, 1);
+		if (trace) {
+			trace_my6502_reg(&record);
+			trace_writes(&record, my6502_mem, &my6502_journal);
+			trace_add(trace, &record);
+		}
 
 		if (cmp_reg()) {
-			printf("! register mismatch\n");
+			printf("! register mismatch at step %llu\n",
+				(unsigned long long)i);
 			dump_fake6502_reg();
 			dump_my6502_reg();
-			return 1;
+			rc = 1;
+			goto out;
 		}
 
-		if (memcmp(fake6502_mem, my6502_mem, sizeof(fake6502_mem))) {
-			printf("! memory mismatch\n");
-			return 1;
+		if (cmp_mem(i % checkpoint_steps == 0)) {
+			printf("! memory mismatch at step %llu\n",
+				(unsigned long long)i);
+			rc = 1;
+			goto out;
+		}
+		fake6502_journal.len = 0;
+		my6502_journal.len = 0;
+
+		if (save_name && i % checkpoint_steps == 0) {
+			save_snapshot(save_name, i);
 		}
 
 		++i;
+	} while (stop != MY6502_STOP_TRAP);
+
+	if (cmp_mem(1)) {
+		printf("! memory mismatch\n");
+		rc = 1;
+		goto out;
 	}
 
-	printf("stopped at pc=0x%4x\n", my_pc);
-	return 0;
+	printf("stopped at pc=0x%4x\n", my_cpu.pc);
+
+out:
+	/* Keep the trace leading to a mismatch. */
+	if (trace && trace_close(trace)) {
+		printf("failed to write the trace\n");
+		rc = 1;
+	}
+	return rc;
 }
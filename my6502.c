@@ -1,793 +1,2484 @@
 #include <assert.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef MY6502_JIT
+#if !defined(__x86_64__)
+#error "MY6502_JIT requires x86-64"
+#endif
+#include <sys/mman.h>
+#endif
+
+#include "my6502.h"
+#include "my6502_internal.h"
 
 /* Documentation:
  * 1. https://www.masswerk.at/6502/6502_instruction_set.html
  * 2. https://stackoverflow.com/questions/16913423/why-is-the-initial-state-of-the-interrupt-flag-of-the-6502-a-1
  */
 
-/* Forward declarations to be provided by the user. */
-uint8_t my6502_read(uint16_t address);
-void my6502_write(uint16_t address, uint8_t value);
+/* Status register helpers. */
+#ifndef MY6502_LAZY_FLAGS
 
-/* Registers. */
-uint16_t my_pc;
-uint8_t my_ac, my_x, my_y, my_sr, my_sp;
+#define SR_CLR(cpu, bit)    ((cpu)->sr &= ~(bit))
+#define SR_SET(cpu, bit)    ((cpu)->sr |= (bit))
 
-/* NV-BDIZC */
-#define SR_FLAG_NEGATIVE  (1 << 7)
-#define SR_FLAG_OVERFLOW  (1 << 6)
+#define SR_IS_SET(cpu, bit) ((cpu)->sr & (bit))
 
-/* At power-up, the 'unused' bit in the Status Register is hardwired
- * to logic '1' by the internal circuitry of the CPU. It can never be
- * anything other than '1', since it is not controlled by any internal
- * flag or register but is determined by a physical connection to
- * a 'high' signal line. */
-#define SR_FLAG_UNUSED    (1 << 5)
+#else
 
-#define SR_FLAG_BREAK     (1 << 4)
-#define SR_FLAG_DECIMAL   (1 << 3)
-#define SR_FLAG_INTERRUPT (1 << 2)
-#define SR_FLAG_ZERO      (1 << 1)
-#define SR_FLAG_CARRY     (1 << 0)
+/* N and Z are computed from the last results stored for them, and C
+ * is kept in a byte of its own, so updating any of them is a plain
+ * store. The rest lives in the status register as usual. The helpers
+ * take a single flag at a time, which is always a constant, so the
+ * compiler picks the right branch. */
+static inline void SR_CLR(struct my6502 *cpu, uint8_t bit)
+{
+	if (bit == SR_FLAG_NEGATIVE) {
+		cpu->n_result = 0;
+	} else if (bit == SR_FLAG_ZERO) {
+		cpu->z_result = 1;
+	} else if (bit == SR_FLAG_CARRY) {
+		cpu->carry = 0;
+	} else {
+		cpu->sr &= ~bit;
+	}
+}
 
-/* Status register helpers. */
-#define SR_CLR(bit)       (my_sr &= ~(bit))
-#define SR_SET(bit)       (my_sr |= (bit))
+static inline void SR_SET(struct my6502 *cpu, uint8_t bit)
+{
+	if (bit == SR_FLAG_NEGATIVE) {
+		cpu->n_result = 0x80;
+	} else if (bit == SR_FLAG_ZERO) {
+		cpu->z_result = 0;
+	} else if (bit == SR_FLAG_CARRY) {
+		cpu->carry = 1;
+	} else {
+		cpu->sr |= bit;
+	}
+}
+
+static inline uint8_t SR_IS_SET(const struct my6502 *cpu, uint8_t bit)
+{
+	if (bit == SR_FLAG_NEGATIVE) {
+		return cpu->n_result & 0x80;
+	} else if (bit == SR_FLAG_ZERO) {
+		return !cpu->z_result;
+	} else if (bit == SR_FLAG_CARRY) {
+		return cpu->carry;
+	} else {
+		return cpu->sr & bit;
+	}
+}
 
-#define SR_IS_SET(bit)    (my_sr & (bit))
+#endif
 
 /* Memory layout. */
 #define STACK_OFFSET      0x100
+#define NMI_OFFSET        0xFFFA
 #define IRQ_OFFSET        0xFFFE
 
-void my6502_reset(uint16_t pc)
+struct my6502_pages {
+	const uint8_t *read[0x100];
+	uint8_t *write[0x100];
+};
+
+/* The page mapping, moved aside while memory hooks are attached. */
+static const uint8_t **my_read_map(struct my6502 *cpu)
 {
-	my_pc = pc;
-	my_ac = 0;
-	my_x = 0;
-	my_y = 0;
-	my_sp = 0xFD;
+	return cpu->mapped ? cpu->mapped->read : cpu->read_pages;
+}
 
-	/* FIXME The I flag must be set. It is commented out
-	 * to match the reference implementation. */
-	my_sr = SR_FLAG_UNUSED /* | SR_FLAG_INTERRUPT */;
+static uint8_t **my_write_map(struct my6502 *cpu)
+{
+	return cpu->mapped ? cpu->mapped->write : cpu->write_pages;
 }
 
-static void my_update_sr(uint8_t value, uint8_t flags)
+static uint64_t my_now_ns(void)
 {
-	if (flags & SR_FLAG_NEGATIVE) {
-		if (value & 0x80) {
-			SR_SET(SR_FLAG_NEGATIVE);
-		} else {
-			SR_CLR(SR_FLAG_NEGATIVE);
-		}
-	}
+	struct timespec ts;
 
-	if (flags & SR_FLAG_ZERO) {
-		if (!value) {
-			SR_SET(SR_FLAG_ZERO);
-		} else {
-			SR_CLR(SR_FLAG_ZERO);
-		}
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-static void my_update_sr_with_carry(uint8_t reg_value, uint8_t flags,
-                                    uint8_t carry_value)
+/* Single writer, so there's no need for an atomic add. */
+static inline void my_metrics_add(_Atomic uint64_t *counter, uint64_t n)
 {
-	my_update_sr(reg_value, flags);
-	if (carry_value) {
-		SR_SET(SR_FLAG_CARRY);
-	} else {
-		SR_CLR(SR_FLAG_CARRY);
-	}
+	atomic_store_explicit(counter, atomic_load_explicit(counter,
+		memory_order_relaxed) + n, memory_order_relaxed);
 }
 
-static void my_push(uint8_t value)
+/* Time a callback into the host, if anyone is watching. */
+static inline uint64_t my_callback_start(struct my6502 *cpu)
 {
-	my6502_write(STACK_OFFSET + my_sp--, value);
+	return cpu->metrics ? my_now_ns() : 0;
 }
 
-static uint8_t my_pop(void)
+static inline void my_callback_end(struct my6502 *cpu, uint64_t start)
 {
-	return my6502_read(STACK_OFFSET + ++my_sp);
+	if (cpu->metrics) {
+		my_metrics_add(&cpu->metrics->callback_ns, my_now_ns() - start);
+	}
 }
 
-/* Addressing modes. */
-enum my_addr {
-	IMMEDIATE,
-	ABSOLUTE,
-	ABSOLUTE_X,
-	ABSOLUTE_Y,
-	ACCUMULATOR,
-	RELATIVE,
-	INDIRECT,
-	INDIRECT_X,
-	INDIRECT_Y,
-	ZEROPAGE,
-	ZEROPAGE_X,
-	ZEROPAGE_Y,
-};
-
-static uint16_t my_read_addr_from_mem(uint16_t *reg)
+static uint8_t my_bus_read(struct my6502 *cpu, uint16_t address)
 {
-	uint16_t addr;
-
-	addr = my6502_read((*reg)++);
-	addr |= (my6502_read((*reg)++) << 8);
+	uint64_t start = my_callback_start(cpu);
+	uint8_t value = cpu->bus->read(cpu->user, address);
 
-	return addr;
+	if (cpu->metrics) {
+		my_metrics_add(&cpu->metrics->mmio, 1);
+	}
+	my_callback_end(cpu, start);
+	return value;
 }
 
-static uint16_t my_read_addr(enum my_addr mode)
+static void my_bus_write(struct my6502 *cpu, uint16_t address, uint8_t value)
 {
-	uint16_t addr;
+	uint64_t start = my_callback_start(cpu);
 
-	switch (mode) {
-	case ABSOLUTE:
-		return my_read_addr_from_mem(&my_pc);
-	case ABSOLUTE_X:
-		return my_read_addr_from_mem(&my_pc) + my_x;
-	case ABSOLUTE_Y:
-		return my_read_addr_from_mem(&my_pc) + my_y;
-	case RELATIVE:
-		addr = my6502_read(my_pc++);
-		return my_pc + (int8_t)addr;
-	case INDIRECT:
-		addr = my_read_addr_from_mem(&my_pc);
-		return my_read_addr_from_mem(&addr);
-	case INDIRECT_X:
-		addr = (my6502_read(my_pc++) + my_x) & 0xFF;
-		return my_read_addr_from_mem(&addr);
-	case INDIRECT_Y:
-		addr = my6502_read(my_pc++);
-		return my_read_addr_from_mem(&addr) + my_y;
-	case ZEROPAGE:
-		return my6502_read(my_pc++);
-	case ZEROPAGE_X:
-		/* Wrap around without penalty for crossing page boundaries. */
-		return (my6502_read(my_pc++) + my_x) & 0xFF;
-	case ZEROPAGE_Y:
-		return (my6502_read(my_pc++) + my_y) & 0xFF;
-	default:
-		assert(0);
-		break;
+	cpu->bus->write(cpu->user, address, value);
+	if (cpu->metrics) {
+		my_metrics_add(&cpu->metrics->mmio, 1);
 	}
+	my_callback_end(cpu, start);
 }
 
-/* Return the 32-bit integer layout for ASL and a few other opcodes:
- *
- * - 0th byte is the effective operand/value
- * - 1st byte is the addressing mode
- * - 2-3rd bytes are the address (machine-native ordering)
- *
- * Most users can discard all but the 0th byte.
- * */
-static uint32_t my_read_op(enum my_addr mode)
+/* Slow path for MMIO, and for all of memory with memory hooks. */
+static uint8_t my_read_slow(struct my6502 *cpu, uint16_t address)
 {
-	uint16_t addr;
+	const uint8_t *page = my_read_map(cpu)[address >> 8];
+	uint8_t value;
 
-	switch (mode) {
-	case ABSOLUTE:
-	case ABSOLUTE_X:
-	case ABSOLUTE_Y:
-	case INDIRECT_X:
-	case INDIRECT_Y:
-	case ZEROPAGE:
-	case ZEROPAGE_X:
-	case ZEROPAGE_Y:
-		addr = my_read_addr(mode);
-		return (addr << 16) | (mode << 8) | my6502_read(addr);
-	case IMMEDIATE:
-		addr = my_pc++;
-		return (addr << 16) | (mode << 8) | my6502_read(addr);
-	case ACCUMULATOR:
-		return (mode << 8) | my_ac;
-	default:
-		assert(0);
-		break;
+	value = page ? page[address & 0xFF] : my_bus_read(cpu, address);
+	if (cpu->hooks.read) {
+		cpu->hooks.read(cpu->hooks.arg, address, value);
 	}
+
+	return value;
 }
 
-static void my_write_op(uint32_t op, uint8_t value)
+static inline uint8_t my_read(struct my6502 *cpu, uint16_t address)
 {
-	enum my_addr mode = (op >> 8) & 0xFF;
-	uint16_t addr = (op >> 16);
+	const uint8_t *page = cpu->read_pages[address >> 8];
 
-	if (mode != ACCUMULATOR) {
-		my6502_write(addr, value);
-	} else {
-		my_ac = value;
+	if (page) {
+		return page[address & 0xFF];
 	}
+
+	return my_read_slow(cpu, address);
 }
 
-/* Add Memory to Accumulator with Carry. */
-static void my_adc(uint8_t value)
-{
-	uint16_t result;
-	uint8_t same_sign;
+static void my_flush_page(struct my6502 *cpu, uint8_t page);
 
-	same_sign = (my_ac & 0x80) == (value & 0x80);
+/* States of cow_pages. A copy is only mapped for reads once reverted,
+ * until the next write. */
+#define MY_COW_SHARED 1
+#define MY_COW_COPIED 2
+#define MY_COW_CLEAN  3
 
-	result = (uint16_t)my_ac + (uint16_t)value;
-	if (SR_IS_SET(SR_FLAG_CARRY)) {
-		result++;
-	}
+/* The pages point to data, so it's freed as the whole. */
+struct my_cow_page {
+	uint8_t data[0x100];
+	const uint8_t *image;
+};
 
-	/* Overflow might have occurred. */
-	if (same_sign && (result & 0x80) != (value & 0x80)) {
-		SR_SET(SR_FLAG_OVERFLOW);
+static uint8_t *my_cow_copy(struct my6502 *cpu, uint8_t page)
+{
+	struct my_cow_page *copy;
+
+	if (cpu->cow_pages[page] == MY_COW_CLEAN) {
+		copy = (struct my_cow_page *)my_read_map(cpu)[page];
 	} else {
-		SR_CLR(SR_FLAG_OVERFLOW);
+		copy = malloc(sizeof(*copy));
+		assert(copy);
+		copy->image = my_read_map(cpu)[page];
+		memcpy(copy->data, copy->image, 0x100);
+		my_read_map(cpu)[page] = copy->data;
+		cpu->cow_copies++;
 	}
 
-	/* It loses the higher byte, but it is OK because we have
-	 * already computed the carry flag to accommodate it. */
-	my_ac = result;
+	my_write_map(cpu)[page] = copy->data;
+	cpu->cow_pages[page] = MY_COW_COPIED;
+	cpu->cow_dirty[cpu->cow_dirty_count++] = page;
 
-	my_update_sr_with_carry(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
-	                        result >= 0x100);
+	return copy->data;
 }
 
-static void my_and(uint8_t value)
+static void my_write_slow(struct my6502 *cpu, uint16_t address,
+                          uint8_t value)
 {
-	my_ac &= value;
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+	uint8_t *page = my_write_map(cpu)[address >> 8];
 
-/* Shift Left One Bit (Memory or Accumulator).*/
-static void my_asl(uint32_t op)
-{
-	uint8_t value = (uint8_t)op;
-	uint8_t msb = value & 0x80;
-	value <<= 1;
-	my_update_sr_with_carry(value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, msb);
-	my_write_op(op, value);
-}
+	if (cpu->hooks.write) {
+		cpu->hooks.write(cpu->hooks.arg, address, value);
+	}
 
-/* Branch on Carry Set. */
-static void my_bcs(uint16_t addr)
-{
-	if (SR_IS_SET(SR_FLAG_CARRY)) {
-		my_pc = addr;
+	if (page) {
+		page[address & 0xFF] = value;
+	} else if (cpu->cow_pages[address >> 8]) {
+		my_cow_copy(cpu, address >> 8)[address & 0xFF] = value;
+	} else {
+		my_bus_write(cpu, address, value);
 	}
 }
 
-/* Test Bits in Memory with Accumulator. */
-static void my_bit(uint8_t value)
+static inline void my_write(struct my6502 *cpu, uint16_t address,
+                            uint8_t value)
 {
-	if (value & SR_FLAG_NEGATIVE) {
-		my_sr |= SR_FLAG_NEGATIVE;
-	} else {
-		my_sr &= ~SR_FLAG_NEGATIVE;
-	}
+	uint8_t *page = cpu->write_pages[address >> 8];
 
-	if (value & SR_FLAG_OVERFLOW) {
-		my_sr |= SR_FLAG_OVERFLOW;
-	} else {
-		my_sr &= ~SR_FLAG_OVERFLOW;
+	if (cpu->code_pages[address >> 8]) {
+		my_flush_page(cpu, address >> 8);
 	}
 
-	if (my_ac & value) {
-		my_sr &= ~SR_FLAG_ZERO;
+	if (page) {
+		page[address & 0xFF] = value;
 	} else {
-		my_sr |= SR_FLAG_ZERO;
+		my_write_slow(cpu, address, value);
 	}
 }
 
-/* Branch on Result not Zero. */
-static void my_bne(uint16_t addr)
+void my6502_cow_revert(struct my6502 *cpu)
 {
-	if (!SR_IS_SET(SR_FLAG_ZERO)) {
-		my_pc = addr;
+	struct my_cow_page *copy;
+	unsigned int i;
+	uint8_t page;
+
+	for (i = 0; i < cpu->cow_dirty_count; i++) {
+		page = cpu->cow_dirty[i];
+		if (cpu->code_pages[page]) {
+			my_flush_page(cpu, page);
+		}
+		copy = (struct my_cow_page *)my_write_map(cpu)[page];
+		memcpy(copy->data, copy->image, 0x100);
+		my_write_map(cpu)[page] = NULL;
+		cpu->cow_pages[page] = MY_COW_CLEAN;
 	}
+	cpu->cow_dirty_count = 0;
 }
 
-/* Branch on Carry Clear. */
-static void my_bcc(uint16_t addr)
+uint8_t my6502_peek(struct my6502 *cpu, uint16_t address)
 {
-	if (!SR_IS_SET(SR_FLAG_CARRY)) {
-		my_pc = addr;
-	}
+	return my_read(cpu, address);
 }
 
-/* Branch on Result Zero. */
-static void my_beq(uint16_t addr)
+void my6502_poke(struct my6502 *cpu, uint16_t address, uint8_t value)
 {
-	if (SR_IS_SET(SR_FLAG_ZERO)) {
-		my_pc = addr;
-	}
+	my_write(cpu, address, value);
 }
 
-static void my_bmi(uint16_t addr)
+void my6502_init(struct my6502 *cpu, const struct my6502_bus *bus,
+                 void *user)
 {
-	if (SR_IS_SET(SR_FLAG_NEGATIVE)) {
-		my_pc = addr;
-	}
+	memset(cpu, 0, sizeof(*cpu));
+	cpu->bus = bus;
+	cpu->user = user;
+	cpu->next_event = UINT64_MAX;
+	cpu->deadline = UINT64_MAX;
 }
 
-/* Branch on Result Plus. */
-static void my_bpl(uint16_t addr)
+void my6502_idle_skip(struct my6502 *cpu, int enable)
 {
-	if (!SR_IS_SET(SR_FLAG_NEGATIVE)) {
-		my_pc = addr;
-	}
+	cpu->idle_skip = enable;
+	cpu->idle_pc = 0;
+	cpu->idle_cycles = 0;
 }
 
-/* Force Break. */
-static void my_brk(void)
+void my6502_map(struct my6502 *cpu, uint16_t address, uint32_t size,
+                uint8_t *mem, int flags)
 {
-	uint16_t return_addr = my_pc + 1;
-
-	my_push(return_addr >> 8);
-	my_push(return_addr);
-	my_push(my_sr | SR_FLAG_BREAK);
+	const uint8_t **read_map = my_read_map(cpu);
+	uint8_t **write_map = my_write_map(cpu);
+	unsigned int page = address >> 8;
+	unsigned int i, j;
 
-	my_pc = my6502_read(IRQ_OFFSET);
-	my_pc |= my6502_read(IRQ_OFFSET + 1) << 8;
+	assert(!(address & 0xFF) && !(size & 0xFF));
+	assert(page + (size >> 8) <= 0x100);
 
-	my_sr |= SR_FLAG_INTERRUPT;
-}
+	for (i = 0; i < (size >> 8); i++) {
+		if (cpu->code_pages[page + i]) {
+			my_flush_page(cpu, page + i);
+		}
+		if (cpu->cow_pages[page + i] == MY_COW_COPIED) {
+			j = 0;
+			while (cpu->cow_dirty[j] != page + i) {
+				j++;
+			}
+			cpu->cow_dirty[j] =
+				cpu->cow_dirty[--cpu->cow_dirty_count];
+		}
+		if (cpu->cow_pages[page + i] == MY_COW_COPIED
+			|| cpu->cow_pages[page + i] == MY_COW_CLEAN) {
+			free((void *)read_map[page + i]);
+			cpu->cow_copies--;
+		}
 
-static void my_bvc(uint16_t addr)
-{
-	if (!SR_IS_SET(SR_FLAG_OVERFLOW)) {
-		my_pc = addr;
+		read_map[page + i] =
+			(flags & (MY6502_MAP_READ | MY6502_MAP_COW))
+			? mem + (i << 8) : NULL;
+		write_map[page + i] =
+			(flags & MY6502_MAP_WRITE) && !(flags & MY6502_MAP_COW)
+			? mem + (i << 8) : NULL;
+		cpu->cow_pages[page + i] =
+			(flags & MY6502_MAP_COW) ? MY_COW_SHARED : 0;
 	}
 }
 
-static void my_bvs(uint16_t addr)
+void my6502_reset(struct my6502 *cpu, uint16_t pc)
 {
-	if (SR_IS_SET(SR_FLAG_OVERFLOW)) {
-		my_pc = addr;
-	}
-}
+	cpu->pc = pc;
+	cpu->ac = 0;
+	cpu->x = 0;
+	cpu->y = 0;
+	cpu->sp = 0xFD;
 
-/* Clear Carry Flag. */
-static void my_clc(void)
-{
-	my_sr &= ~SR_FLAG_CARRY;
+	/* FIXME The I flag must be set. It is commented out
+	 * to match the reference implementation. */
+	my6502_set_sr(cpu, SR_FLAG_UNUSED /* | SR_FLAG_INTERRUPT */);
 }
 
-/* Clear Decimal Mode. */
-static void my_cld(void)
+uint8_t my6502_get_sr(const struct my6502 *cpu)
 {
-	my_sr &= ~SR_FLAG_DECIMAL;
-}
+#ifndef MY6502_LAZY_FLAGS
+	return cpu->sr;
+#else
+	uint8_t sr = cpu->sr & ~(SR_FLAG_NEGATIVE | SR_FLAG_ZERO | SR_FLAG_CARRY);
 
-static void my_cli(void)
-{
-	my_sr &= ~SR_FLAG_INTERRUPT;
+	sr |= cpu->n_result & SR_FLAG_NEGATIVE;
+	sr |= cpu->z_result ? 0 : SR_FLAG_ZERO;
+	sr |= cpu->carry ? SR_FLAG_CARRY : 0;
+	return sr;
+#endif
 }
 
-static void my_clv(void)
+/* Clearing the I flag lets a held IRQ in. */
+static inline void my_irq_unmasked(struct my6502 *cpu)
 {
-	my_sr &= ~SR_FLAG_OVERFLOW;
+	if (cpu->irq_lines && !(cpu->sr & SR_FLAG_INTERRUPT)) {
+		cpu->next_event = 0;
+		cpu->block_flushed = 1;
+	}
 }
 
-static void my_cmp(uint8_t value)
+void my6502_set_sr(struct my6502 *cpu, uint8_t sr)
 {
-	my_update_sr_with_carry(my_ac - value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
-	                        my_ac >= value);
+	cpu->sr = sr;
+#ifdef MY6502_LAZY_FLAGS
+	cpu->n_result = sr;
+	cpu->z_result = !(sr & SR_FLAG_ZERO);
+	cpu->carry = sr & SR_FLAG_CARRY;
+#endif
+	my_irq_unmasked(cpu);
 }
 
-static void my_cpx(uint8_t value)
+static void my_update_sr(struct my6502 *cpu, uint8_t value, uint8_t flags)
 {
-	my_update_sr_with_carry(my_x - value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
-	                        my_x >= value);
-}
+#ifdef MY6502_LAZY_FLAGS
+	if (flags & SR_FLAG_NEGATIVE) {
+		cpu->n_result = value;
+	}
 
-static void my_cpy(uint8_t value)
-{
-	my_update_sr_with_carry(my_y - value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
-	                        my_y >= value);
-}
+	if (flags & SR_FLAG_ZERO) {
+		cpu->z_result = value;
+	}
+#else
+	if (flags & SR_FLAG_NEGATIVE) {
+		if (value & 0x80) {
+			SR_SET(cpu, SR_FLAG_NEGATIVE);
+		} else {
+			SR_CLR(cpu, SR_FLAG_NEGATIVE);
+		}
+	}
 
-static void my_dec(uint16_t addr)
-{
-	uint8_t value = my6502_read(addr);
-	my_update_sr(--value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-	my6502_write(addr, value);
+	if (flags & SR_FLAG_ZERO) {
+		if (!value) {
+			SR_SET(cpu, SR_FLAG_ZERO);
+		} else {
+			SR_CLR(cpu, SR_FLAG_ZERO);
+		}
+	}
+#endif
 }
 
-/* Decrement Index X by One */
-static void my_dex(void)
+static void my_update_sr_with_carry(struct my6502 *cpu, uint8_t reg_value,
+                                    uint8_t flags, uint8_t carry_value)
 {
-	my_update_sr(--my_x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	my_update_sr(cpu, reg_value, flags);
+#ifdef MY6502_LAZY_FLAGS
+	cpu->carry = carry_value != 0;
+#else
+	if (carry_value) {
+		SR_SET(cpu, SR_FLAG_CARRY);
+	} else {
+		SR_CLR(cpu, SR_FLAG_CARRY);
+	}
+#endif
 }
 
-/* Decrement Index Y by One */
-static void my_dey(void)
+static void my_push(struct my6502 *cpu, uint8_t value)
 {
-	my_update_sr(--my_y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	my_write(cpu, STACK_OFFSET + cpu->sp--, value);
 }
 
-/* Exclusive-OR Memory with Accumulator. */
-static void my_eor(uint8_t value)
+static uint8_t my_pop(struct my6502 *cpu)
 {
-	my_ac ^= value;
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return my_read(cpu, STACK_OFFSET + ++cpu->sp);
 }
 
-static void my_jmp(uint16_t addr)
+/* Instruction size in bytes per addressing mode. */
+#define SIZE_IMPLIED      1
+#define SIZE_IMMEDIATE    2
+#define SIZE_ABSOLUTE     3
+#define SIZE_ABSOLUTE_X   3
+#define SIZE_ABSOLUTE_Y   3
+#define SIZE_ACCUMULATOR  1
+#define SIZE_RELATIVE     2
+#define SIZE_INDIRECT     3
+#define SIZE_INDIRECT_X   2
+#define SIZE_INDIRECT_Y   2
+#define SIZE_ZEROPAGE     2
+#define SIZE_ZEROPAGE_X   2
+#define SIZE_ZEROPAGE_Y   2
+
+/* Instruction size per opcode, zero for unknown opcodes. */
+static const uint8_t my_sizes[0x100] = {
+#define OP(code, name, mode, cycles, flags, kind) [code] = SIZE_##mode,
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+unsigned int my6502_insn_size(uint8_t opcode)
 {
-	my_pc = addr;
+	return my_sizes[opcode];
 }
 
-/* Jump to New Location Saving Return Address. */
-static void my_jsr(uint16_t addr)
+static const struct {
+	const char *name;
+	uint8_t mode;
+} my_disasm_ops[0x100] = {
+#define OP(code, name, mode, cycles, flags, kind) [code] = { #name, mode },
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+unsigned int my6502_disasm(uint16_t pc, const uint8_t *bytes, char *buf,
+                           size_t size)
 {
-	/* Mimic the hardware behaviour that saves the 8-bit buffer. */
-	uint16_t old_pc = my_pc - 1;
+	uint8_t opcode = bytes[0];
+	uint16_t word = bytes[1] | (bytes[2] << 8);
+	char name[4];
+	int i;
 
-	my_push(old_pc >> 8);
-	my_push(old_pc);
+	if (!my_sizes[opcode]) {
+		snprintf(buf, size, ".byte $%02X", opcode);
+		return 1;
+	}
 
-	my_pc = addr;
-}
+	for (i = 0; i < 3; i++) {
+		name[i] = toupper((unsigned char)my_disasm_ops[opcode].name[i]);
+	}
+	name[3] = '\0';
 
-static void my_inc(uint16_t addr)
-{
-	uint8_t value = my6502_read(addr);
-	my_update_sr(++value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-	my6502_write(addr, value);
-}
+	switch (my_disasm_ops[opcode].mode) {
+	case IMPLIED:
+		snprintf(buf, size, "%s", name);
+		break;
+	case ACCUMULATOR:
+		snprintf(buf, size, "%s A", name);
+		break;
+	case IMMEDIATE:
+		snprintf(buf, size, "%s #$%02X", name, bytes[1]);
+		break;
+	case ABSOLUTE:
+		snprintf(buf, size, "%s $%04X", name, word);
+		break;
+	case ABSOLUTE_X:
+		snprintf(buf, size, "%s $%04X,X", name, word);
+		break;
+	case ABSOLUTE_Y:
+		snprintf(buf, size, "%s $%04X,Y", name, word);
+		break;
+	case RELATIVE:
+		snprintf(buf, size, "%s $%04X", name,
+			(uint16_t)(pc + 2 + (int8_t)bytes[1]));
+		break;
+	case INDIRECT:
+		snprintf(buf, size, "%s ($%04X)", name, word);
+		break;
+	case INDIRECT_X:
+		snprintf(buf, size, "%s ($%02X,X)", name, bytes[1]);
+		break;
+	case INDIRECT_Y:
+		snprintf(buf, size, "%s ($%02X),Y", name, bytes[1]);
+		break;
+	case ZEROPAGE:
+		snprintf(buf, size, "%s $%02X", name, bytes[1]);
+		break;
+	case ZEROPAGE_X:
+		snprintf(buf, size, "%s $%02X,X", name, bytes[1]);
+		break;
+	case ZEROPAGE_Y:
+		snprintf(buf, size, "%s $%02X,Y", name, bytes[1]);
+		break;
+	}
 
-static void my_inx(void)
-{
-	my_update_sr(++my_x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+	return my_sizes[opcode];
+}
+
+#ifdef MY6502_STATS
+
+static const char *const my_mode_names[] = {
+	[IMPLIED] = "implied",
+	[IMMEDIATE] = "immediate",
+	[ABSOLUTE] = "absolute",
+	[ABSOLUTE_X] = "absolute_x",
+	[ABSOLUTE_Y] = "absolute_y",
+	[ACCUMULATOR] = "accumulator",
+	[RELATIVE] = "relative",
+	[INDIRECT] = "indirect",
+	[INDIRECT_X] = "indirect_x",
+	[INDIRECT_Y] = "indirect_y",
+	[ZEROPAGE] = "zeropage",
+	[ZEROPAGE_X] = "zeropage_x",
+	[ZEROPAGE_Y] = "zeropage_y",
+};
 
-static void my_iny(void)
-{
-	my_update_sr(++my_y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+#define MY_MODE_COUNT (sizeof(my_mode_names) / sizeof(my_mode_names[0]))
 
-/* Load Accumulator with Memory */
-static void my_lda(uint8_t value)
+void my6502_dump_stats(const struct my6502 *cpu, FILE *f)
 {
-	my_ac = value;
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+	const struct my6502_stats *stats = &cpu->stats;
+	uint64_t mode_count[MY_MODE_COUNT] = { 0 };
+	uint64_t mode_cycles[MY_MODE_COUNT] = { 0 };
+	uint64_t total = 0;
+	uint8_t order[0x100];
+	unsigned int i, j, n = 0;
+	uint8_t mode, tmp;
 
-static void my_ldx(uint8_t value)
-{
-	my_x = value;
-	my_update_sr(my_x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+	/* Executed opcodes, hottest first. */
+	for (i = 0; i < 0x100; i++) {
+		if (!stats->count[i]) {
+			continue;
+		}
+		total += stats->count[i];
+		mode = my_disasm_ops[i].mode;
+		mode_count[mode] += stats->count[i];
+		mode_cycles[mode] += stats->cycles[i];
+
+		order[n] = i;
+		for (j = n++; j > 0
+			&& stats->count[order[j - 1]] < stats->count[order[j]]; j--) {
+			tmp = order[j - 1];
+			order[j - 1] = order[j];
+			order[j] = tmp;
+		}
+	}
 
-static void my_ldy(uint8_t value)
-{
-	my_y = value;
-	my_update_sr(my_y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+	fprintf(f, "op mnemonic mode        count                cycles         %%\n");
+	for (i = 0; i < n; i++) {
+		fprintf(f, "%02x %.3s      %-11s %-20llu %-14llu %5.2f\n",
+			order[i], my_disasm_ops[order[i]].name,
+			my_mode_names[my_disasm_ops[order[i]].mode],
+			(unsigned long long)stats->count[order[i]],
+			(unsigned long long)stats->cycles[order[i]],
+			100.0 * stats->count[order[i]] / total);
+	}
 
-/* Shift One Bit Right (Memory or Accumulator) */
-static void my_lsr(uint32_t op)
-{
-	uint8_t value = (uint8_t)op;
-	uint8_t lsb = value & 0x01;
-	value >>= 1;
-	my_update_sr_with_carry(value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, lsb);
-	my_write_op(op, value);
+	fprintf(f, "mode        count                cycles         %%\n");
+	for (i = 0; i < MY_MODE_COUNT; i++) {
+		if (!mode_count[i]) {
+			continue;
+		}
+		fprintf(f, "%-11s %-20llu %-14llu %5.2f\n", my_mode_names[i],
+			(unsigned long long)mode_count[i],
+			(unsigned long long)mode_cycles[i],
+			100.0 * mode_count[i] / total);
+	}
 }
 
-static void my_nop(void)
-{
-}
+#endif
 
-static void my_ora(uint8_t value)
-{
-	my_ac |= value;
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+/* Base cycle counts per opcode, with MY6502_PAGE_CYCLE for the ones
+ * taking one more when indexing crosses a page boundary. P stays
+ * defined for the handlers generated from the table further down. */
+#define P MY6502_PAGE_CYCLE
 
-static void my_rol(uint32_t op)
+static const uint8_t my_cycles[0x100] = {
+#define OP(code, name, mode, cycles, flags, kind) [code] = cycles,
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+/* Status flags per opcode. */
+#define MY_FLAGS_NONE 0
+#define MY_FLAGS_NZ (SR_FLAG_NEGATIVE | SR_FLAG_ZERO)
+#define MY_FLAGS_NZC (MY_FLAGS_NZ | SR_FLAG_CARRY)
+#define MY_FLAGS_NVZ (MY_FLAGS_NZ | SR_FLAG_OVERFLOW)
+#define MY_FLAGS_NVZC (MY_FLAGS_NZC | SR_FLAG_OVERFLOW)
+#define MY_FLAGS_C SR_FLAG_CARRY
+#define MY_FLAGS_D SR_FLAG_DECIMAL
+#define MY_FLAGS_I SR_FLAG_INTERRUPT
+#define MY_FLAGS_V SR_FLAG_OVERFLOW
+#define MY_FLAGS_ALL (MY_FLAGS_NVZC | SR_FLAG_DECIMAL | SR_FLAG_INTERRUPT)
+
+static const uint8_t my_flags[0x100] = {
+#define OP(code, name, mode, cycles, flags, kind) [code] = MY_FLAGS_##flags,
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+unsigned int my6502_insn_cycles(uint8_t opcode)
 {
-	uint8_t value = (uint8_t)op;
-	uint8_t msb = value & 0x80;
-	value = (value << 1) + (my_sr & SR_FLAG_CARRY);
-	my_update_sr_with_carry(value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, msb);
-	my_write_op(op, value);
+	return my_cycles[opcode];
 }
 
-static void my_ror(uint32_t op)
+unsigned int my6502_insn_flags(uint8_t opcode)
 {
-	uint8_t value = (uint8_t)op;
-	uint8_t lsb = value & 0x01;
-	value = (value >> 1) + (my_sr & SR_FLAG_CARRY ? 0x80 : 0x00);
-	my_update_sr_with_carry(value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, lsb);
-	my_write_op(op, value);
+	return my_flags[opcode];
 }
 
-static void my_rti(void)
+/* Execution counters. Every engine takes the clock before the opcode
+ * cycles are added and counts the instruction once it's done. */
+#ifdef MY6502_STATS
+#define MY_STATS_DECL(start) uint64_t start
+#define MY_STATS_START(cpu, start) ((start) = (cpu)->cycles)
+#define MY_STATS_END(cpu, opcode, start)				\
+	do {								\
+		(cpu)->stats.count[opcode]++;				\
+		(cpu)->stats.cycles[opcode] += (cpu)->cycles - (start);	\
+	} while (0)
+#else
+#define MY_STATS_DECL(start)
+#define MY_STATS_START(cpu, start) ((void)0)
+#define MY_STATS_END(cpu, opcode, start) ((void)0)
+#endif
+
+/* Fetch the operand bytes following the opcode. */
+static inline uint16_t my_fetch_operand(struct my6502 *cpu, uint8_t size)
 {
-	my_sr = my_pop() | SR_FLAG_BREAK;
+	uint16_t operand = 0;
 
-	my_pc = my_pop();
-	my_pc |= my_pop() << 8;
-}
+	if (size > 1) {
+		operand = my_read(cpu, cpu->pc++);
+	}
 
-static void my_rts(void)
-{
-	my_pc = my_pop();
-	my_pc |= my_pop() << 8;
+	if (size > 2) {
+		operand |= my_read(cpu, cpu->pc++) << 8;
+	}
 
-	/* Mimic the hardware behaviour, see JSR. */
-	my_pc++;
+	return operand;
 }
 
-/* Push Accumulator on Stack. */
-static void my_pha(void)
+/* The high byte of a pointer is read from the same page as the low
+ * one, so (zp,X) and (zp),Y wrap around the zero page, and so does
+ * JMP ($xxFF) around its page on the NMOS 6502. */
+static uint16_t my_read_pointer(struct my6502 *cpu, uint16_t addr)
 {
-	my_push(my_ac);
+	return my_read(cpu, addr)
+		| my_read(cpu, (addr & 0xFF00) | (uint8_t)(addr + 1)) << 8;
 }
 
-static void my_php(void)
+/* Add an index and note whether it crosses a page boundary. */
+static uint16_t my_index(struct my6502 *cpu, uint16_t addr, uint8_t index)
 {
-	/* The status register will be pushed with the break
-	 * flag and bit 5 set to 1. */
-	my_push(my_sr | SR_FLAG_BREAK);
-}
+	uint16_t result = addr + index;
 
-/* Pull Accumulator from Stack. */
-static void my_pla(void)
-{
-	my_ac = my_pop();
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	cpu->page_crossed = (result ^ addr) > 0xFF;
+	return result;
 }
 
-/* Pull Processor Status from Stack. */
-static void my_plp(void)
+/* Effective address per addressing mode, named after the mode so that
+ * the opcode table picks the one for each handler. */
+static inline uint16_t my_addr_ABSOLUTE(struct my6502 *cpu, uint16_t operand)
 {
-	/* The unused bit must always be set. */
-	my_sr = my_pop() | SR_FLAG_UNUSED;
+	return operand;
 }
 
-/* Subtract Memory from Accumulator with Borrow. */
-static void my_sbc(uint8_t value)
+static inline uint16_t my_addr_ABSOLUTE_X(struct my6502 *cpu,
+                                          uint16_t operand)
 {
-	/*
-	 * z = y - x
-	 *   = y + (-x)
-	 *   = y + ~x + 1
-	 *
-	 * The carry flag has an inverted meaning:
-	 * - Set means no borrowing, business as usual.
-	 * - Unset means to borrow, take away another one.
-	 */
-	my_adc(~value);
+	return my_index(cpu, operand, cpu->x);
 }
 
-static void my_sec(void)
+static inline uint16_t my_addr_ABSOLUTE_Y(struct my6502 *cpu,
+                                          uint16_t operand)
 {
-	my_sr |= SR_FLAG_CARRY;
+	return my_index(cpu, operand, cpu->y);
 }
 
-static void my_sed(void)
+static inline uint16_t my_addr_RELATIVE(struct my6502 *cpu, uint16_t operand)
 {
-	my_sr |= SR_FLAG_DECIMAL;
+	return cpu->pc + (int8_t)operand;
 }
 
-static void my_sei(void)
+static inline uint16_t my_addr_INDIRECT(struct my6502 *cpu, uint16_t operand)
 {
-	my_sr |= SR_FLAG_INTERRUPT;
+	return my_read_pointer(cpu, operand);
 }
 
-static void my_sta(uint16_t addr)
+static inline uint16_t my_addr_INDIRECT_X(struct my6502 *cpu,
+                                          uint16_t operand)
 {
-	my6502_write(addr, my_ac);
+	return my_read_pointer(cpu, (operand + cpu->x) & 0xFF);
 }
 
-static void my_stx(uint16_t addr)
+static inline uint16_t my_addr_INDIRECT_Y(struct my6502 *cpu,
+                                          uint16_t operand)
 {
-	my6502_write(addr, my_x);
+	return my_index(cpu, my_read_pointer(cpu, operand), cpu->y);
 }
 
-static void my_sty(uint16_t addr)
+static inline uint16_t my_addr_ZEROPAGE(struct my6502 *cpu, uint16_t operand)
 {
-	my6502_write(addr, my_y);
+	return operand;
 }
 
-/* Transfer Accumulator to Index X. */
-static void my_tax(void)
+/* Wrap around without penalty for crossing page boundaries. */
+static inline uint16_t my_addr_ZEROPAGE_X(struct my6502 *cpu,
+                                          uint16_t operand)
 {
-	my_x = my_ac;
-	my_update_sr(my_x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return (operand + cpu->x) & 0xFF;
 }
 
-static void my_tay(void)
+static inline uint16_t my_addr_ZEROPAGE_Y(struct my6502 *cpu,
+                                          uint16_t operand)
 {
-	my_y = my_ac;
-	my_update_sr(my_y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return (operand + cpu->y) & 0xFF;
 }
 
-/* Transfer Stack Pointer to Index X. */
-static void my_tsx(void)
+/* Operand value per addressing mode, memory at the effective address
+ * but for immediate. */
+static inline uint8_t my_load_IMMEDIATE(struct my6502 *cpu, uint16_t operand)
 {
-	my_x = my_sp;
-	my_update_sr(my_x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return operand;
 }
 
-static void my_txa(void)
-{
-	my_ac = my_x;
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+#define MY_LOAD(mode)							\
+static inline uint8_t my_load_##mode(struct my6502 *cpu, uint16_t operand) \
+{									\
+	return my_read(cpu, my_addr_##mode(cpu, operand));		\
 }
 
-/* Transfer Index X to Stack Register. */
-static void my_txs(void)
-{
-	my_sp = my_x;
-}
+MY_LOAD(ABSOLUTE)
+MY_LOAD(ABSOLUTE_X)
+MY_LOAD(ABSOLUTE_Y)
+MY_LOAD(INDIRECT_X)
+MY_LOAD(INDIRECT_Y)
+MY_LOAD(ZEROPAGE)
+MY_LOAD(ZEROPAGE_X)
+MY_LOAD(ZEROPAGE_Y)
+#undef MY_LOAD
 
-/* Transfer Index Y to Accumulator. */
-static void my_tya(void)
-{
-	my_ac = my_y;
-	my_update_sr(my_ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
-}
+/* Read-modify-write per addressing mode. */
+#define MY_MODIFY_ACCUMULATOR(name) (cpu->ac = my_##name(cpu, cpu->ac))
 
-#define OP(code, action) case code: action; break
+#define MY_MODIFY_MEMORY(name, mode)					\
+	do {								\
+		uint16_t addr = my_addr_##mode(cpu, operand);		\
+									\
+		my_write(cpu, addr, my_##name(cpu, my_read(cpu, addr)));	\
+	} while (0)
 
-void my6502_step(void)
-{
-	uint8_t opcode = my6502_read(my_pc++);
+#define MY_MODIFY_ABSOLUTE(name) MY_MODIFY_MEMORY(name, ABSOLUTE)
+#define MY_MODIFY_ABSOLUTE_X(name) MY_MODIFY_MEMORY(name, ABSOLUTE_X)
+#define MY_MODIFY_ZEROPAGE(name) MY_MODIFY_MEMORY(name, ZEROPAGE)
+#define MY_MODIFY_ZEROPAGE_X(name) MY_MODIFY_MEMORY(name, ZEROPAGE_X)
+
+/* The handler call of an opcode, with cpu and operand in scope, see
+ * my6502_opcodes.h. */
+#define MY_IMPLIED(name, mode) my_##name(cpu)
+#define MY_READ(name, mode) my_##name(cpu, my_load_##mode(cpu, operand))
+#define MY_ADDRESS(name, mode) my_##name(cpu, my_addr_##mode(cpu, operand))
+#define MY_MODIFY(name, mode) MY_MODIFY_##mode(name)
+
+#define MY_ACTION(name, mode, kind) MY_##kind(name, mode)
+
+/* An opcode from the table, after it's fetched and before its operand
+ * is. The cycles are constant, so only the opcodes that may take the
+ * page crossing penalty check for it. */
+#define MY_EXECUTE(clocks, name, mode, kind)				\
+	do {								\
+		cpu->cycles += (clocks) & 0x7F;				\
+		operand = my_fetch_operand(cpu, SIZE_##mode);		\
+		MY_ACTION(name, mode, kind);				\
+		if ((clocks) & MY6502_PAGE_CYCLE) {			\
+			cpu->cycles += cpu->page_crossed;		\
+		}							\
+	} while (0)
+
+static void my_adc_binary(struct my6502 *cpu, uint8_t value)
+{
+	uint16_t result;
+	uint8_t same_sign;
+
+	same_sign = (cpu->ac & 0x80) == (value & 0x80);
+
+	result = (uint16_t)cpu->ac + (uint16_t)value;
+	if (SR_IS_SET(cpu, SR_FLAG_CARRY)) {
+		result++;
+	}
+
+	/* Overflow might have occurred. */
+	if (same_sign && (result & 0x80) != (value & 0x80)) {
+		SR_SET(cpu, SR_FLAG_OVERFLOW);
+	} else {
+		SR_CLR(cpu, SR_FLAG_OVERFLOW);
+	}
+
+	/* It loses the higher byte, but it is OK because we have
+	 * already computed the carry flag to accommodate it. */
+	cpu->ac = result;
+
+	my_update_sr_with_carry(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
+	                        result >= 0x100);
+}
+
+#ifndef MY6502_NES_CPU
+
+/* Decimal mode as on the NMOS part. A digit is adjusted by looking up
+ * its binary sum or difference, carry or borrow in included, and the
+ * table gives the decimal digit with the carry or borrow out in bit 4.
+ * Invalid BCD digits come out as the real thing makes them. */
+
+/* Indexed by 0x00-0x1F. */
+static const uint8_t my_bcd_add[0x20] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15,
+	0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D,
+	0x1E, 0x1F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15,
+};
+
+/* Indexed by -0x10-0x0F, two's complement in 5 bits. */
+static const uint8_t my_bcd_sub[0x20] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x10, 0x11,
+	0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+};
+
+/* N and V come from the sum before the high digit is adjusted, and Z
+ * from the binary sum. */
+static void my_adc_decimal(struct my6502 *cpu, uint8_t value)
+{
+	uint8_t carry = SR_IS_SET(cpu, SR_FLAG_CARRY) != 0;
+	uint8_t lo, hi;
+	uint16_t sum;
+
+	lo = my_bcd_add[(cpu->ac & 0x0F) + (value & 0x0F) + carry];
+	sum = (cpu->ac & 0xF0) + (value & 0xF0) + lo;
+	hi = my_bcd_add[sum >> 4];
+
+	if (~(cpu->ac ^ value) & (cpu->ac ^ sum) & 0x80) {
+		SR_SET(cpu, SR_FLAG_OVERFLOW);
+	} else {
+		SR_CLR(cpu, SR_FLAG_OVERFLOW);
+	}
+	my_update_sr(cpu, cpu->ac + value + carry, SR_FLAG_ZERO);
+	my_update_sr_with_carry(cpu, sum, SR_FLAG_NEGATIVE, hi & 0x10);
+
+	cpu->ac = hi << 4 | (lo & 0x0F);
+}
+
+/* All the flags are binary, only the accumulator differs. */
+static uint8_t my_sbc_decimal(uint8_t ac, uint8_t value, uint8_t carry)
+{
+	uint8_t lo, hi;
+
+	lo = my_bcd_sub[((ac & 0x0F) - (value & 0x0F) + carry - 1) & 0x1F];
+	hi = my_bcd_sub[((ac >> 4) - (value >> 4) - (lo >> 4)) & 0x1F];
+
+	return hi << 4 | (lo & 0x0F);
+}
+
+#endif
+
+/* Add Memory to Accumulator with Carry. */
+static void my_adc(struct my6502 *cpu, uint8_t value)
+{
+#ifndef MY6502_NES_CPU
+	if (cpu->sr & SR_FLAG_DECIMAL) {
+		my_adc_decimal(cpu, value);
+		return;
+	}
+#endif
+	my_adc_binary(cpu, value);
+}
+
+static void my_and(struct my6502 *cpu, uint8_t value)
+{
+	cpu->ac &= value;
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Shift Left One Bit (Memory or Accumulator).*/
+static uint8_t my_asl(struct my6502 *cpu, uint8_t value)
+{
+	uint8_t msb = value & 0x80;
+	value <<= 1;
+	my_update_sr_with_carry(cpu, value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, msb);
+	return value;
+}
+
+/* Idle loops.
+ *
+ * A short backward branch may close a loop that only reads memory and
+ * tests it, such as "wait: BIT $2002 / BPL wait". If the registers are
+ * the same as on the previous iteration, the loop spins for as long as
+ * the memory it reads doesn't change. With idle skipping the host
+ * promises that such memory only changes at next_event, so the clock
+ * goes straight to the last iteration before it. */
+#define MY_IDLE_MAX 16
+
+/* Opcodes that neither write memory nor touch the stack or PC, except
+ * for branches. */
+static const uint8_t my_idle_ops[0x100] = {
+	/* LDA, LDX, LDY */
+	[0xA9] = 1, [0xA5] = 1, [0xB5] = 1, [0xAD] = 1, [0xBD] = 1,
+	[0xB9] = 1, [0xA1] = 1, [0xB1] = 1,
+	[0xA2] = 1, [0xA6] = 1, [0xB6] = 1, [0xAE] = 1, [0xBE] = 1,
+	[0xA0] = 1, [0xA4] = 1, [0xB4] = 1, [0xAC] = 1, [0xBC] = 1,
+	/* CMP, CPX, CPY, BIT */
+	[0xC9] = 1, [0xC5] = 1, [0xD5] = 1, [0xCD] = 1, [0xDD] = 1,
+	[0xD9] = 1, [0xC1] = 1, [0xD1] = 1,
+	[0xE0] = 1, [0xE4] = 1, [0xEC] = 1,
+	[0xC0] = 1, [0xC4] = 1, [0xCC] = 1,
+	[0x24] = 1, [0x2C] = 1,
+	/* AND, ORA, EOR */
+	[0x29] = 1, [0x25] = 1, [0x2D] = 1,
+	[0x09] = 1, [0x05] = 1, [0x0D] = 1,
+	[0x49] = 1, [0x45] = 1, [0x4D] = 1,
+	/* Transfers, flags, NOP */
+	[0xAA] = 1, [0xA8] = 1, [0x8A] = 1, [0x98] = 1,
+	[0x18] = 1, [0x38] = 1, [0xB8] = 1, [0xEA] = 1,
+	/* Branches */
+	[0x10] = 1, [0x30] = 1, [0x50] = 1, [0x70] = 1,
+	[0x90] = 1, [0xB0] = 1, [0xD0] = 1, [0xF0] = 1,
+};
+
+/* Check the loop from start up to end, the PC after the branch closing
+ * it. Return the number of instructions in it and their cycles without
+ * page crossings, or zero if it's not a candidate. */
+static unsigned int my_idle_loop(const struct my6502 *cpu, uint16_t start,
+                                 uint16_t end, unsigned int *cycles)
+{
+	const uint8_t *page = cpu->read_pages[start >> 8];
+	unsigned int count = 0;
+	uint16_t pc = start;
+	uint8_t opcode;
+
+	/* Within a single mapped page, read without side effects. */
+	if (!page || (start >> 8) != ((end - 1) >> 8)) {
+		return 0;
+	}
+
+	/* Taken branch on the same page. */
+	*cycles = 1;
+	while (pc < end) {
+		opcode = page[pc & 0xFF];
+		if (!my_idle_ops[opcode]) {
+			return 0;
+		}
+		*cycles += my_cycles[opcode] & 0x7F;
+		pc += my_sizes[opcode];
+		count++;
+	}
+
+	return pc == end ? count : 0;
+}
+
+static void my_idle(struct my6502 *cpu, uint16_t start)
+{
+	uint8_t sr = my6502_get_sr(cpu);
+	unsigned int count, cycles;
+	uint64_t period, skip;
+
+	if (cpu->idle_pc == start && cpu->idle_ac == cpu->ac
+		&& cpu->idle_x == cpu->x && cpu->idle_y == cpu->y
+		&& cpu->idle_sr == sr && cpu->next_event > cpu->cycles
+		&& cpu->next_event != UINT64_MAX) {
+		period = cpu->cycles - cpu->idle_cycles;
+		count = my_idle_loop(cpu, start, cpu->pc, &cycles);
+
+		/* Exactly one iteration since, each indexed read may have
+		 * crossed a page. */
+		if (count && period >= cycles && period <= cycles + count) {
+			skip = (cpu->next_event - cpu->cycles) / period;
+			if (skip > cpu->idle_budget / count)
+				skip = cpu->idle_budget / count;
+			cpu->idle_budget -= skip * count;
+			cpu->cycles += skip * period;
+			cpu->instructions += skip * count;
+		}
+	}
+
+	cpu->idle_pc = start;
+	cpu->idle_ac = cpu->ac;
+	cpu->idle_x = cpu->x;
+	cpu->idle_y = cpu->y;
+	cpu->idle_sr = sr;
+	cpu->idle_cycles = cpu->cycles;
+}
+
+/* Take a branch, which costs one more cycle or two if the target
+ * is on another page. */
+static void my_branch(struct my6502 *cpu, uint16_t addr)
+{
+	cpu->cycles += ((cpu->pc ^ addr) > 0xFF) ? 2 : 1;
+	if (cpu->idle_skip && addr < cpu->pc
+		&& cpu->pc - addr <= MY_IDLE_MAX) {
+		my_idle(cpu, addr);
+	}
+	cpu->pc = addr;
+}
+
+/* Branch on Carry Set. */
+static void my_bcs(struct my6502 *cpu, uint16_t addr)
+{
+	if (SR_IS_SET(cpu, SR_FLAG_CARRY)) {
+		my_branch(cpu, addr);
+	}
+}
+
+/* Test Bits in Memory with Accumulator. */
+static void my_bit(struct my6502 *cpu, uint8_t value)
+{
+	if (value & SR_FLAG_NEGATIVE) {
+		SR_SET(cpu, SR_FLAG_NEGATIVE);
+	} else {
+		SR_CLR(cpu, SR_FLAG_NEGATIVE);
+	}
+
+	if (value & SR_FLAG_OVERFLOW) {
+		cpu->sr |= SR_FLAG_OVERFLOW;
+	} else {
+		cpu->sr &= ~SR_FLAG_OVERFLOW;
+	}
+
+	if (cpu->ac & value) {
+		SR_CLR(cpu, SR_FLAG_ZERO);
+	} else {
+		SR_SET(cpu, SR_FLAG_ZERO);
+	}
+}
+
+/* Branch on Result not Zero. */
+static void my_bne(struct my6502 *cpu, uint16_t addr)
+{
+	if (!SR_IS_SET(cpu, SR_FLAG_ZERO)) {
+		my_branch(cpu, addr);
+	}
+}
+
+/* Branch on Carry Clear. */
+static void my_bcc(struct my6502 *cpu, uint16_t addr)
+{
+	if (!SR_IS_SET(cpu, SR_FLAG_CARRY)) {
+		my_branch(cpu, addr);
+	}
+}
+
+/* Branch on Result Zero. */
+static void my_beq(struct my6502 *cpu, uint16_t addr)
+{
+	if (SR_IS_SET(cpu, SR_FLAG_ZERO)) {
+		my_branch(cpu, addr);
+	}
+}
+
+static void my_bmi(struct my6502 *cpu, uint16_t addr)
+{
+	if (SR_IS_SET(cpu, SR_FLAG_NEGATIVE)) {
+		my_branch(cpu, addr);
+	}
+}
+
+/* Branch on Result Plus. */
+static void my_bpl(struct my6502 *cpu, uint16_t addr)
+{
+	if (!SR_IS_SET(cpu, SR_FLAG_NEGATIVE)) {
+		my_branch(cpu, addr);
+	}
+}
+
+#ifdef MY6502_PROFILE
+/* Shadow call stack for the profiler. A frame is dropped once the stack
+ * pointer is back above where the call left it, which copes with code
+ * that drops return addresses or returns through pushed ones. */
+static inline void my_call(struct my6502 *cpu, uint16_t entry)
+{
+	if (cpu->call_depth < MY6502_CALL_DEPTH) {
+		cpu->calls[cpu->call_depth].entry = entry;
+		cpu->calls[cpu->call_depth].sp = cpu->sp;
+	}
+	cpu->call_depth++;
+}
+
+static inline void my_return(struct my6502 *cpu)
+{
+	/* Frames past the limit are not kept, assume one per return. */
+	if (cpu->call_depth > MY6502_CALL_DEPTH) {
+		cpu->call_depth--;
+		return;
+	}
+
+	while (cpu->call_depth
+		&& cpu->calls[cpu->call_depth - 1].sp < cpu->sp) {
+		cpu->call_depth--;
+	}
+}
+#else
+#define my_call(cpu, entry) ((void)0)
+#define my_return(cpu) ((void)0)
+#endif
+
+/* Force Break. */
+static void my_brk(struct my6502 *cpu)
+{
+	uint16_t return_addr = cpu->pc + 1;
+
+	my_push(cpu, return_addr >> 8);
+	my_push(cpu, return_addr);
+	my_push(cpu, my6502_get_sr(cpu) | SR_FLAG_BREAK);
+
+	cpu->pc = my_read(cpu, IRQ_OFFSET);
+	cpu->pc |= my_read(cpu, IRQ_OFFSET + 1) << 8;
+
+	cpu->sr |= SR_FLAG_INTERRUPT;
+	my_call(cpu, cpu->pc);
+}
+
+static void my_bvc(struct my6502 *cpu, uint16_t addr)
+{
+	if (!SR_IS_SET(cpu, SR_FLAG_OVERFLOW)) {
+		my_branch(cpu, addr);
+	}
+}
+
+static void my_bvs(struct my6502 *cpu, uint16_t addr)
+{
+	if (SR_IS_SET(cpu, SR_FLAG_OVERFLOW)) {
+		my_branch(cpu, addr);
+	}
+}
+
+/* Clear Carry Flag. */
+static void my_clc(struct my6502 *cpu)
+{
+	SR_CLR(cpu, SR_FLAG_CARRY);
+}
+
+/* Clear Decimal Mode. */
+static void my_cld(struct my6502 *cpu)
+{
+	cpu->sr &= ~SR_FLAG_DECIMAL;
+}
+
+static void my_cli(struct my6502 *cpu)
+{
+	cpu->sr &= ~SR_FLAG_INTERRUPT;
+	my_irq_unmasked(cpu);
+}
+
+static void my_clv(struct my6502 *cpu)
+{
+	cpu->sr &= ~SR_FLAG_OVERFLOW;
+}
+
+static void my_cmp(struct my6502 *cpu, uint8_t value)
+{
+	my_update_sr_with_carry(cpu, cpu->ac - value,
+	                        SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
+	                        cpu->ac >= value);
+}
+
+static void my_cpx(struct my6502 *cpu, uint8_t value)
+{
+	my_update_sr_with_carry(cpu, cpu->x - value,
+	                        SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
+	                        cpu->x >= value);
+}
+
+static void my_cpy(struct my6502 *cpu, uint8_t value)
+{
+	my_update_sr_with_carry(cpu, cpu->y - value,
+	                        SR_FLAG_NEGATIVE | SR_FLAG_ZERO,
+	                        cpu->y >= value);
+}
+
+static uint8_t my_dec(struct my6502 *cpu, uint8_t value)
+{
+	my_update_sr(cpu, --value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return value;
+}
+
+/* Decrement Index X by One */
+static void my_dex(struct my6502 *cpu)
+{
+	my_update_sr(cpu, --cpu->x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Decrement Index Y by One */
+static void my_dey(struct my6502 *cpu)
+{
+	my_update_sr(cpu, --cpu->y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Exclusive-OR Memory with Accumulator. */
+static void my_eor(struct my6502 *cpu, uint8_t value)
+{
+	cpu->ac ^= value;
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static void my_jmp(struct my6502 *cpu, uint16_t addr)
+{
+	cpu->pc = addr;
+}
+
+/* Jump to New Location Saving Return Address. */
+static void my_jsr(struct my6502 *cpu, uint16_t addr)
+{
+	/* Mimic the hardware behaviour that saves the 8-bit buffer. */
+	uint16_t old_pc = cpu->pc - 1;
+
+	my_push(cpu, old_pc >> 8);
+	my_push(cpu, old_pc);
+
+	cpu->pc = addr;
+	my_call(cpu, addr);
+}
+
+static uint8_t my_inc(struct my6502 *cpu, uint8_t value)
+{
+	my_update_sr(cpu, ++value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return value;
+}
+
+static void my_inx(struct my6502 *cpu)
+{
+	my_update_sr(cpu, ++cpu->x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static void my_iny(struct my6502 *cpu)
+{
+	my_update_sr(cpu, ++cpu->y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Load Accumulator with Memory */
+static void my_lda(struct my6502 *cpu, uint8_t value)
+{
+	cpu->ac = value;
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static void my_ldx(struct my6502 *cpu, uint8_t value)
+{
+	cpu->x = value;
+	my_update_sr(cpu, cpu->x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static void my_ldy(struct my6502 *cpu, uint8_t value)
+{
+	cpu->y = value;
+	my_update_sr(cpu, cpu->y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Shift One Bit Right (Memory or Accumulator) */
+static uint8_t my_lsr(struct my6502 *cpu, uint8_t value)
+{
+	uint8_t lsb = value & 0x01;
+	value >>= 1;
+	my_update_sr_with_carry(cpu, value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, lsb);
+	return value;
+}
+
+static void my_nop(struct my6502 *cpu)
+{
+}
+
+static void my_ora(struct my6502 *cpu, uint8_t value)
+{
+	cpu->ac |= value;
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static uint8_t my_rol(struct my6502 *cpu, uint8_t value)
+{
+	uint8_t msb = value & 0x80;
+	value = (value << 1) + (SR_IS_SET(cpu, SR_FLAG_CARRY) ? 0x01 : 0x00);
+	my_update_sr_with_carry(cpu, value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, msb);
+	return value;
+}
+
+static uint8_t my_ror(struct my6502 *cpu, uint8_t value)
+{
+	uint8_t lsb = value & 0x01;
+	value = (value >> 1) + (SR_IS_SET(cpu, SR_FLAG_CARRY) ? 0x80 : 0x00);
+	my_update_sr_with_carry(cpu, value, SR_FLAG_NEGATIVE | SR_FLAG_ZERO, lsb);
+	return value;
+}
+
+static void my_rti(struct my6502 *cpu)
+{
+	/* As PLP does. */
+	my6502_set_sr(cpu, my_pop(cpu) | SR_FLAG_UNUSED);
+
+	cpu->pc = my_pop(cpu);
+	cpu->pc |= my_pop(cpu) << 8;
+	my_return(cpu);
+}
+
+static void my_rts(struct my6502 *cpu)
+{
+	cpu->pc = my_pop(cpu);
+	cpu->pc |= my_pop(cpu) << 8;
+
+	/* Mimic the hardware behaviour, see JSR. */
+	cpu->pc++;
+	my_return(cpu);
+}
+
+/* Push Accumulator on Stack. */
+static void my_pha(struct my6502 *cpu)
+{
+	my_push(cpu, cpu->ac);
+}
+
+static void my_php(struct my6502 *cpu)
+{
+	/* The status register will be pushed with the break
+	 * flag and bit 5 set to 1. */
+	my_push(cpu, my6502_get_sr(cpu) | SR_FLAG_BREAK);
+}
+
+/* Pull Accumulator from Stack. */
+static void my_pla(struct my6502 *cpu)
+{
+	cpu->ac = my_pop(cpu);
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Pull Processor Status from Stack. */
+static void my_plp(struct my6502 *cpu)
+{
+	/* The unused bit must always be set. */
+	my6502_set_sr(cpu, my_pop(cpu) | SR_FLAG_UNUSED);
+}
+
+/* Subtract Memory from Accumulator with Borrow. */
+static void my_sbc(struct my6502 *cpu, uint8_t value)
+{
+	/*
+	 * z = y - x
+	 *   = y + (-x)
+	 *   = y + ~x + 1
+	 *
+	 * The carry flag has an inverted meaning:
+	 * - Set means no borrowing, business as usual.
+	 * - Unset means to borrow, take away another one.
+	 */
+#ifndef MY6502_NES_CPU
+	uint8_t ac = cpu->ac;
+	uint8_t carry = SR_IS_SET(cpu, SR_FLAG_CARRY) != 0;
+
+	my_adc_binary(cpu, ~value);
+	if (cpu->sr & SR_FLAG_DECIMAL) {
+		cpu->ac = my_sbc_decimal(ac, value, carry);
+	}
+#else
+	my_adc_binary(cpu, ~value);
+#endif
+}
+
+static void my_sec(struct my6502 *cpu)
+{
+	SR_SET(cpu, SR_FLAG_CARRY);
+}
+
+static void my_sed(struct my6502 *cpu)
+{
+	cpu->sr |= SR_FLAG_DECIMAL;
+}
+
+static void my_sei(struct my6502 *cpu)
+{
+	cpu->sr |= SR_FLAG_INTERRUPT;
+}
+
+static void my_sta(struct my6502 *cpu, uint16_t addr)
+{
+	my_write(cpu, addr, cpu->ac);
+}
+
+static void my_stx(struct my6502 *cpu, uint16_t addr)
+{
+	my_write(cpu, addr, cpu->x);
+}
+
+static void my_sty(struct my6502 *cpu, uint16_t addr)
+{
+	my_write(cpu, addr, cpu->y);
+}
+
+/* Transfer Accumulator to Index X. */
+static void my_tax(struct my6502 *cpu)
+{
+	cpu->x = cpu->ac;
+	my_update_sr(cpu, cpu->x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static void my_tay(struct my6502 *cpu)
+{
+	cpu->y = cpu->ac;
+	my_update_sr(cpu, cpu->y, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Transfer Stack Pointer to Index X. */
+static void my_tsx(struct my6502 *cpu)
+{
+	cpu->x = cpu->sp;
+	my_update_sr(cpu, cpu->x, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+static void my_txa(struct my6502 *cpu)
+{
+	cpu->ac = cpu->x;
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Transfer Index X to Stack Register. */
+static void my_txs(struct my6502 *cpu)
+{
+	cpu->sp = cpu->x;
+}
+
+/* Transfer Index Y to Accumulator. */
+static void my_tya(struct my6502 *cpu)
+{
+	cpu->ac = cpu->y;
+	my_update_sr(cpu, cpu->ac, SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+}
+
+/* Return the opcode executed. */
+static inline uint8_t my_step(struct my6502 *cpu)
+{
+	uint8_t opcode = my_read(cpu, cpu->pc++);
+	uint16_t operand;
+	MY_STATS_DECL(start);
+
+	MY_STATS_START(cpu, start);
+
+	/* Only opcodes with indexed addressing have the penalty and they
+	 * always update the flag, so there's no need to reset it. */
+	switch (opcode) {
+#define OP(code, name, mode, clocks, flags, kind)			\
+	case code:							\
+		MY_EXECUTE(clocks, name, mode, kind);			\
+		break;
+#include "my6502_opcodes.h"
+#undef OP
+	default:
+		assert(0);
+		break;
+	}
+
+	MY_STATS_END(cpu, opcode, start);
+	return opcode;
+}
+
+void my6502_step(struct my6502 *cpu)
+{
+	my_step(cpu);
+	cpu->instructions++;
+}
+
+int my6502_set_breakpoint(struct my6502 *cpu, uint16_t address, int enable)
+{
+	unsigned int i;
+
+	for (i = 0; i < cpu->breakpoint_count; i++) {
+		if (cpu->breakpoints[i] == address) {
+			break;
+		}
+	}
+
+	if (enable && i == cpu->breakpoint_count) {
+		if (i == MY6502_MAX_BREAKPOINTS) {
+			return -1;
+		}
+		cpu->breakpoints[cpu->breakpoint_count++] = address;
+	} else if (!enable && i < cpu->breakpoint_count) {
+		cpu->breakpoints[i] =
+			cpu->breakpoints[--cpu->breakpoint_count];
+	}
+
+	return 0;
+}
+
+static int my_is_breakpoint(struct my6502 *cpu, uint16_t address)
+{
+	unsigned int i;
+
+	for (i = 0; i < cpu->breakpoint_count; i++) {
+		if (cpu->breakpoints[i] == address) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Events and interrupts.
+ *
+ * Run loops only compare the cycle count to next_event, which is the
+ * earliest scheduled event, the deadline, or zero for an interrupt to
+ * take. Everything else happens in my_events() once it's due. */
+static void my_update_next_event(struct my6502 *cpu)
+{
+	uint64_t next = cpu->deadline;
+
+	if (cpu->event_count && cpu->events[0].cycles < next) {
+		next = cpu->events[0].cycles;
+	}
+	if (cpu->nmi_pending
+		|| (cpu->irq_lines && !(cpu->sr & SR_FLAG_INTERRUPT))) {
+		next = 0;
+	}
+
+	cpu->next_event = next;
+}
+
+static int my_event_before(const struct my6502_event *a,
+                           const struct my6502_event *b)
+{
+	return a->cycles < b->cycles
+		|| (a->cycles == b->cycles && a->seq < b->seq);
+}
+
+static void my_event_swap(struct my6502 *cpu, unsigned int i, unsigned int j)
+{
+	struct my6502_event tmp = cpu->events[i];
+
+	cpu->events[i] = cpu->events[j];
+	cpu->events[j] = tmp;
+}
+
+static void my_event_up(struct my6502 *cpu, unsigned int i)
+{
+	while (i && my_event_before(&cpu->events[i],
+		&cpu->events[(i - 1) / 2])) {
+		my_event_swap(cpu, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void my_event_down(struct my6502 *cpu, unsigned int i)
+{
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < cpu->event_count) {
+		if (child + 1 < cpu->event_count
+			&& my_event_before(&cpu->events[child + 1],
+				&cpu->events[child])) {
+			child++;
+		}
+		if (!my_event_before(&cpu->events[child], &cpu->events[i])) {
+			break;
+		}
+		my_event_swap(cpu, i, child);
+		i = child;
+	}
+}
+
+void my6502_set_next_event(struct my6502 *cpu, uint64_t cycles)
+{
+	cpu->deadline = cycles;
+	my_update_next_event(cpu);
+}
+
+int my6502_schedule(struct my6502 *cpu, uint64_t cycles,
+                    void (*fn)(struct my6502 *cpu, void *arg), void *arg)
+{
+	struct my6502_event *e;
+
+	if (cpu->event_count == MY6502_MAX_EVENTS) {
+		return -1;
+	}
+
+	e = &cpu->events[cpu->event_count];
+	e->cycles = cycles;
+	e->seq = cpu->event_seq++;
+	e->fn = fn;
+	e->arg = arg;
+	my_event_up(cpu, cpu->event_count++);
+
+	my_update_next_event(cpu);
+	return 0;
+}
+
+void my6502_cancel(struct my6502 *cpu,
+                   void (*fn)(struct my6502 *cpu, void *arg), void *arg)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < cpu->event_count; i++) {
+		if (cpu->events[i].fn != fn || cpu->events[i].arg != arg) {
+			cpu->events[n++] = cpu->events[i];
+		}
+	}
+	cpu->event_count = n;
+
+	for (i = n / 2; i-- > 0;) {
+		my_event_down(cpu, i);
+	}
+
+	my_update_next_event(cpu);
+}
+
+void my6502_irq(struct my6502 *cpu, unsigned int line, int asserted)
+{
+	if (asserted) {
+		cpu->irq_lines |= 1 << line;
+		my_irq_unmasked(cpu);
+	} else {
+		cpu->irq_lines &= ~(1 << line);
+	}
+}
+
+void my6502_nmi(struct my6502 *cpu)
+{
+	cpu->nmi_pending = 1;
+	cpu->next_event = 0;
+	cpu->block_flushed = 1;
+}
+
+static void my_interrupt(struct my6502 *cpu, uint16_t vector)
+{
+	if (cpu->hooks.interrupt) {
+		cpu->hooks.interrupt(cpu->hooks.arg, cpu, vector);
+	}
+
+	my_push(cpu, cpu->pc >> 8);
+	my_push(cpu, cpu->pc);
+	/* As BRK, but with the B flag clear. */
+	my_push(cpu, my6502_get_sr(cpu) & ~SR_FLAG_BREAK);
+
+	cpu->pc = my_read(cpu, vector);
+	cpu->pc |= my_read(cpu, vector + 1) << 8;
+
+	cpu->sr |= SR_FLAG_INTERRUPT;
+	cpu->cycles += 7;
+	my_call(cpu, cpu->pc);
+
+	/* Whatever block was running is left. */
+	cpu->block_flushed = 1;
+}
+
+/* Fire the due events and take an interrupt, return 1 if the deadline
+ * is reached. */
+static int my_events(struct my6502 *cpu)
+{
+	struct my6502_event e;
+	uint64_t start;
+
+	while (cpu->event_count && cpu->events[0].cycles <= cpu->cycles) {
+		e = cpu->events[0];
+		cpu->events[0] = cpu->events[--cpu->event_count];
+		my_event_down(cpu, 0);
+		start = my_callback_start(cpu);
+		e.fn(cpu, e.arg);
+		my_callback_end(cpu, start);
+	}
+
+	if (cpu->nmi_pending) {
+		cpu->nmi_pending = 0;
+		my_interrupt(cpu, NMI_OFFSET);
+	} else if (cpu->irq_lines && !(cpu->sr & SR_FLAG_INTERRUPT)) {
+		my_interrupt(cpu, IRQ_OFFSET);
+	}
+
+	my_update_next_event(cpu);
+	return cpu->cycles >= cpu->deadline;
+}
+
+static inline int my_event_due(struct my6502 *cpu, enum my6502_stop *stop)
+{
+	if (cpu->cycles >= cpu->next_event && my_events(cpu)) {
+		*stop = MY6502_STOP_EVENT;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Check whether my6502_run() has to stop after the instruction
+ * at last_pc. */
+static inline int my_stopped(struct my6502 *cpu, uint16_t last_pc,
+                             enum my6502_stop *stop)
+{
+	/* We're in a trap if PC doesn't change, i.e. "jmp *", unless
+	 * there is an event or an interrupt to wait for. */
+	if (cpu->pc == last_pc && !cpu->event_count && !cpu->nmi_pending
+		&& !(cpu->irq_lines && !(cpu->sr & SR_FLAG_INTERRUPT))) {
+		*stop = MY6502_STOP_TRAP;
+		return 1;
+	}
+
+	if (cpu->breakpoint_count && my_is_breakpoint(cpu, cpu->pc)) {
+		*stop = MY6502_STOP_BREAKPOINT;
+		return 1;
+	}
+
+	return my_event_due(cpu, stop);
+}
+
+/* Basic block cache.
+ *
+ * A block is a run of instructions starting at a given PC and ending
+ * with a branch, jump, call, return, BRK or MY_BLOCK_MAX instructions.
+ * Only code in pages mapped for reads is cached. Writes to pages
+ * holding cached code drop blocks that might cover them. */
+#define MY_BLOCK_CACHE_SZ 1024
+#define MY_BLOCK_MAX      16
+
+struct my_insn {
+	uint8_t opcode;
+	uint8_t size;
+	uint8_t cycles;
+	uint16_t operand;
+};
+
+struct my6502_block {
+	uint16_t pc;
+	/* Zero for an empty entry. */
+	uint8_t count;
+	struct my_insn insns[MY_BLOCK_MAX];
+#ifdef MY6502_JIT
+	/* Times entered before compiling, and the compiled code. */
+	uint32_t hits;
+	void *code;
+#endif
+};
+
+int my6502_block_cache(struct my6502 *cpu, int enable)
+{
+#ifdef MY6502_JIT
+	/* Compiled code belongs to the blocks. */
+	my6502_jit(cpu, 0);
+#endif
+	free(cpu->blocks);
+	cpu->blocks = NULL;
+	memset(cpu->code_pages, 0, sizeof(cpu->code_pages));
+
+	if (enable) {
+		cpu->blocks = calloc(MY_BLOCK_CACHE_SZ, sizeof(*cpu->blocks));
+		if (!cpu->blocks) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void my_flush_page(struct my6502 *cpu, uint8_t page)
+{
+	/* Blocks are at most 3 * MY_BLOCK_MAX bytes long, so the ones
+	 * covering the page start either within it or the page before. */
+	uint8_t prev = page - 1;
+	unsigned int i;
+
+	for (i = 0; i < MY_BLOCK_CACHE_SZ; i++) {
+		uint8_t start = cpu->blocks[i].pc >> 8;
+
+		if (start == page || start == prev) {
+			cpu->blocks[i].count = 0;
+		}
+	}
+
+	cpu->code_pages[page] = 0;
+	cpu->block_flushed = 1;
+}
+
+static int my_ends_block(uint8_t opcode)
+{
 	switch (opcode) {
-	OP(0x00, my_brk());
-	OP(0x01, my_ora(my_read_op(INDIRECT_X)));
-	OP(0x05, my_ora(my_read_op(ZEROPAGE)));
-	OP(0x06, my_asl(my_read_op(ZEROPAGE)));
-	OP(0x08, my_php());
-	OP(0x09, my_ora(my_read_op(IMMEDIATE)));
-	OP(0x0A, my_asl(my_read_op(ACCUMULATOR)));
-	OP(0x0D, my_ora(my_read_op(ABSOLUTE)));
-	OP(0x0E, my_asl(my_read_op(ABSOLUTE)));
-	OP(0x10, my_bpl(my_read_addr(RELATIVE)));
-	OP(0x11, my_ora(my_read_op(INDIRECT_Y)));
-	OP(0x15, my_ora(my_read_op(ZEROPAGE_X)));
-	OP(0x16, my_asl(my_read_op(ZEROPAGE_X)));
-	OP(0x18, my_clc());
-	OP(0x19, my_ora(my_read_op(ABSOLUTE_Y)));
-	OP(0x1D, my_ora(my_read_op(ABSOLUTE_X)));
-	OP(0x1E, my_asl(my_read_op(ABSOLUTE_X)));
-	OP(0x20, my_jsr(my_read_addr(ABSOLUTE)));
-	OP(0x21, my_and(my_read_op(INDIRECT_X)));
-	OP(0x24, my_bit(my_read_op(ZEROPAGE)));
-	OP(0x25, my_and(my_read_op(ZEROPAGE)));
-	OP(0x26, my_rol(my_read_op(ZEROPAGE)));
-	OP(0x28, my_plp());
-	OP(0x29, my_and(my_read_op(IMMEDIATE)));
-	OP(0x2A, my_rol(my_read_op(ACCUMULATOR)));
-	OP(0x2C, my_bit(my_read_op(ABSOLUTE)));
-	OP(0x2D, my_and(my_read_op(ABSOLUTE)));
-	OP(0x2E, my_rol(my_read_op(ABSOLUTE)));
-	OP(0x30, my_bmi(my_read_addr(RELATIVE)));
-	OP(0x31, my_and(my_read_op(INDIRECT_Y)));
-	OP(0x35, my_and(my_read_op(ZEROPAGE_X)));
-	OP(0x36, my_rol(my_read_op(ZEROPAGE_X)));
-	OP(0x38, my_sec());
-	OP(0x39, my_and(my_read_op(ABSOLUTE_Y)));
-	OP(0x3D, my_and(my_read_op(ABSOLUTE_X)));
-	OP(0x3E, my_rol(my_read_op(ABSOLUTE_X)));
-	OP(0x40, my_rti());
-	OP(0x41, my_eor(my_read_op(INDIRECT_X)));
-	OP(0x45, my_eor(my_read_op(ZEROPAGE)));
-	OP(0x46, my_lsr(my_read_op(ZEROPAGE)));
-	OP(0x48, my_pha());
-	OP(0x49, my_eor(my_read_op(IMMEDIATE)));
-	OP(0x4A, my_lsr(my_read_op(ACCUMULATOR)));
-	OP(0x4C, my_jmp(my_read_addr(ABSOLUTE)));
-	OP(0x4D, my_eor(my_read_op(ABSOLUTE)));
-	OP(0x4E, my_lsr(my_read_op(ABSOLUTE)));
-	OP(0x50, my_bvc(my_read_addr(RELATIVE)));
-	OP(0x51, my_eor(my_read_op(INDIRECT_Y)));
-	OP(0x55, my_eor(my_read_op(ZEROPAGE_X)));
-	OP(0x56, my_lsr(my_read_op(ZEROPAGE_X)));
-	OP(0x58, my_cli());
-	OP(0x59, my_eor(my_read_op(ABSOLUTE_Y)));
-	OP(0x5D, my_eor(my_read_op(ABSOLUTE_X)));
-	OP(0x5E, my_lsr(my_read_op(ABSOLUTE_X)));
-	OP(0x60, my_rts());
-	OP(0x61, my_adc(my_read_op(INDIRECT_X)));
-	OP(0x65, my_adc(my_read_op(ZEROPAGE)));
-	OP(0x66, my_ror(my_read_op(ZEROPAGE)));
-	OP(0x68, my_pla());
-	OP(0x69, my_adc(my_read_op(IMMEDIATE)));
-	OP(0x6A, my_ror(my_read_op(ACCUMULATOR)));
-	OP(0x6C, my_jmp(my_read_addr(INDIRECT)));
-	OP(0x6D, my_adc(my_read_op(ABSOLUTE)));
-	OP(0x6E, my_ror(my_read_op(ABSOLUTE)));
-	OP(0x70, my_bvs(my_read_addr(RELATIVE)));
-	OP(0x71, my_adc(my_read_op(INDIRECT_Y)));
-	OP(0x75, my_adc(my_read_op(ZEROPAGE_X)));
-	OP(0x76, my_ror(my_read_op(ZEROPAGE_X)));
-	OP(0x78, my_sei());
-	OP(0x79, my_adc(my_read_op(ABSOLUTE_Y)));
-	OP(0x7D, my_adc(my_read_op(ABSOLUTE_X)));
-	OP(0x7E, my_ror(my_read_op(ABSOLUTE_X)));
-	OP(0x81, my_sta(my_read_addr(INDIRECT_X)));
-	OP(0x84, my_sty(my_read_addr(ZEROPAGE)));
-	OP(0x85, my_sta(my_read_addr(ZEROPAGE)));
-	OP(0x86, my_stx(my_read_addr(ZEROPAGE)));
-	OP(0x88, my_dey());
-	OP(0x8A, my_txa());
-	OP(0x8C, my_sty(my_read_addr(ABSOLUTE)));
-	OP(0x8D, my_sta(my_read_addr(ABSOLUTE)));
-	OP(0x8E, my_stx(my_read_addr(ABSOLUTE)));
-	OP(0x90, my_bcc(my_read_addr(RELATIVE)));
-	OP(0x91, my_sta(my_read_addr(INDIRECT_Y)));
-	OP(0x94, my_sty(my_read_addr(ZEROPAGE_X)));
-	OP(0x95, my_sta(my_read_addr(ZEROPAGE_X)));
-	OP(0x96, my_stx(my_read_addr(ZEROPAGE_Y)));
-	OP(0x98, my_tya());
-	OP(0x99, my_sta(my_read_addr(ABSOLUTE_Y)));
-	OP(0x9A, my_txs());
-	OP(0x9D, my_sta(my_read_addr(ABSOLUTE_X)));
-	OP(0xA0, my_ldy(my_read_op(IMMEDIATE)));
-	OP(0xA1, my_lda(my_read_op(INDIRECT_X)));
-	OP(0xA2, my_ldx(my_read_op(IMMEDIATE)));
-	OP(0xA4, my_ldy(my_read_op(ZEROPAGE)));
-	OP(0xA5, my_lda(my_read_op(ZEROPAGE)));
-	OP(0xA6, my_ldx(my_read_op(ZEROPAGE)));
-	OP(0xA8, my_tay());
-	OP(0xA9, my_lda(my_read_op(IMMEDIATE)));
-	OP(0xAA, my_tax());
-	OP(0xAC, my_ldy(my_read_op(ABSOLUTE)));
-	OP(0xAD, my_lda(my_read_op(ABSOLUTE)));
-	OP(0xAE, my_ldx(my_read_op(ABSOLUTE)));
-	OP(0xB0, my_bcs(my_read_addr(RELATIVE)));
-	OP(0xB1, my_lda(my_read_op(INDIRECT_Y)));
-	OP(0xB4, my_ldy(my_read_op(ZEROPAGE_X)));
-	OP(0xB5, my_lda(my_read_op(ZEROPAGE_X)));
-	OP(0xB6, my_ldx(my_read_op(ZEROPAGE_Y)));
-	OP(0xB8, my_clv());
-	OP(0xB9, my_lda(my_read_op(ABSOLUTE_Y)));
-	OP(0xBA, my_tsx());
-	OP(0xBC, my_ldy(my_read_op(ABSOLUTE_X)));
-	OP(0xBD, my_lda(my_read_op(ABSOLUTE_X)));
-	OP(0xBE, my_ldx(my_read_op(ABSOLUTE_Y)));
-	OP(0xC0, my_cpy(my_read_op(IMMEDIATE)));
-	OP(0xC1, my_cmp(my_read_op(INDIRECT_X)));
-	OP(0xC4, my_cpy(my_read_op(ZEROPAGE)));
-	OP(0xC5, my_cmp(my_read_op(ZEROPAGE)));
-	OP(0xC6, my_dec(my_read_addr(ZEROPAGE)));
-	OP(0xC8, my_iny());
-	OP(0xC9, my_cmp(my_read_op(IMMEDIATE)));
-	OP(0xCA, my_dex());
-	OP(0xCC, my_cpy(my_read_op(ABSOLUTE)));
-	OP(0xCD, my_cmp(my_read_op(ABSOLUTE)));
-	OP(0xCE, my_dec(my_read_addr(ABSOLUTE)));
-	OP(0xD0, my_bne(my_read_addr(RELATIVE)));
-	OP(0xD1, my_cmp(my_read_op(INDIRECT_Y)));
-	OP(0xD5, my_cmp(my_read_op(ZEROPAGE_X)));
-	OP(0xD6, my_dec(my_read_addr(ZEROPAGE_X)));
-	OP(0xD8, my_cld());
-	OP(0xD9, my_cmp(my_read_op(ABSOLUTE_Y)));
-	OP(0xDD, my_cmp(my_read_op(ABSOLUTE_X)));
-	OP(0xDE, my_dec(my_read_addr(ABSOLUTE_X)));
-	OP(0xE0, my_cpx(my_read_op(IMMEDIATE)));
-	OP(0xE1, my_sbc(my_read_op(INDIRECT_X)));
-	OP(0xE6, my_inc(my_read_addr(ZEROPAGE)));
-	OP(0xE4, my_cpx(my_read_op(ZEROPAGE)));
-	OP(0xE5, my_sbc(my_read_op(ZEROPAGE)));
-	OP(0xE8, my_inx());
-	OP(0xE9, my_sbc(my_read_op(IMMEDIATE)));
-	OP(0xEA, my_nop());
-	OP(0xEC, my_cpx(my_read_op(ABSOLUTE)));
-	OP(0xED, my_sbc(my_read_op(ABSOLUTE)));
-	OP(0xEE, my_inc(my_read_addr(ABSOLUTE)));
-	OP(0xF0, my_beq(my_read_addr(RELATIVE)));
-	OP(0xF1, my_sbc(my_read_op(INDIRECT_Y)));
-	OP(0xF5, my_sbc(my_read_op(ZEROPAGE_X)));
-	OP(0xF6, my_inc(my_read_addr(ZEROPAGE_X)));
-	OP(0xF8, my_sed());
-	OP(0xF9, my_sbc(my_read_op(ABSOLUTE_Y)));
-	OP(0xFD, my_sbc(my_read_op(ABSOLUTE_X)));
-	OP(0xFE, my_inc(my_read_addr(ABSOLUTE_X)));
+	case 0x00: /* BRK */
+	case 0x20: /* JSR */
+	case 0x40: /* RTI */
+	case 0x4C: /* JMP */
+	case 0x60: /* RTS */
+	case 0x6C: /* JMP */
+		return 1;
+	default:
+		/* Branches are the only users of relative addressing. */
+		return (opcode & 0x1F) == 0x10;
+	}
+}
+
+static void my_decode_block(struct my6502 *cpu, struct my6502_block *block,
+                            uint16_t pc)
+{
+	struct my_insn *insn;
+	uint16_t addr = pc;
+	uint8_t opcode;
+	unsigned int i;
+
+	block->pc = pc;
+	block->count = 0;
+#ifdef MY6502_JIT
+	block->hits = 0;
+	block->code = NULL;
+#endif
+
+	while (block->count < MY_BLOCK_MAX) {
+		/* Reading unmapped pages may have side effects. */
+		for (i = 0; i < 3; i++) {
+			if (!cpu->read_pages[(uint16_t)(addr + i) >> 8]) {
+				return;
+			}
+		}
+
+		opcode = cpu->read_pages[addr >> 8][addr & 0xFF];
+		if (!my_sizes[opcode]) {
+			return;
+		}
+
+		insn = &block->insns[block->count++];
+		insn->opcode = opcode;
+		insn->size = my_sizes[opcode];
+		insn->cycles = my_cycles[opcode];
+		insn->operand = 0;
+		for (i = 1; i < insn->size; i++) {
+			uint16_t a = addr + i;
+
+			insn->operand |= cpu->read_pages[a >> 8][a & 0xFF]
+				<< (8 * (i - 1));
+		}
+
+		for (i = 0; i < insn->size; i++) {
+			cpu->code_pages[(uint16_t)(addr + i) >> 8] = 1;
+		}
+
+		addr += insn->size;
+		if (my_ends_block(opcode)) {
+			return;
+		}
+	}
+}
+
+/* Same as my_step() with the instruction already decoded. */
+static inline void my_execute(struct my6502 *cpu, const struct my_insn *insn)
+{
+	uint16_t operand = insn->operand;
+	MY_STATS_DECL(start);
+
+	MY_STATS_START(cpu, start);
+	cpu->pc += insn->size;
+	cpu->cycles += insn->cycles & 0x7F;
+
+	switch (insn->opcode) {
+#define OP(code, name, mode, clocks, flags, kind)			\
+	case code: MY_ACTION(name, mode, kind); break;
+#include "my6502_opcodes.h"
+#undef OP
 	default:
 		assert(0);
 		break;
 	}
+
+	cpu->cycles += (insn->cycles >> 7) & cpu->page_crossed;
+	MY_STATS_END(cpu, insn->opcode, start);
+}
+
+#ifdef MY6502_JIT
+
+/* Dynamic recompiler for x86-64 (System V ABI).
+ *
+ * Hot blocks are translated into a sequence of direct calls to
+ * handlers specialized per opcode, with all operands inlined as
+ * immediates. It saves the decode and dispatch of the interpreter,
+ * while the handlers stay the very same code the interpreter runs.
+ *
+ * Compiled code is called as uint32_t code(cpu, budget) and returns
+ * what is left of the budget. It executes at most budget instructions,
+ * so my6502_run(cpu, 1) checks the translation of every instruction
+ * in lockstep, and it leaves after any instruction that dropped a
+ * cached block, so self-modifying code gets back to the interpreter
+ * and decoded again. Blocks don't cover MMIO pages in the first place,
+ * see my_decode_block().
+ *
+ * The arena is never writable and executable at once: it's mapped
+ * read-write and only made executable between compiles. */
+#define MY_JIT_ARENA_SZ (1 << 20)
+
+struct my6502_jit {
+	uint32_t threshold;
+	uint8_t *arena;
+	size_t used;
+};
+
+typedef uint32_t (*my_jit_code)(struct my6502 *cpu, uint32_t budget);
+
+#define OP(code, name, mode, clocks, flags, kind)			\
+static void my_op_##code(struct my6502 *cpu, uint16_t operand)		\
+{									\
+	MY_STATS_DECL(start);						\
+									\
+	MY_STATS_START(cpu, start);					\
+	cpu->pc += SIZE_##mode;						\
+	cpu->cycles += (clocks) & 0x7F;					\
+	MY_ACTION(name, mode, kind);					\
+	if ((clocks) & MY6502_PAGE_CYCLE) {				\
+		cpu->cycles += cpu->page_crossed;			\
+	}								\
+	MY_STATS_END(cpu, code, start);					\
+}
+#include "my6502_opcodes.h"
+#undef OP
+
+static void (*const my_ops[0x100])(struct my6502 *cpu, uint16_t operand) = {
+#define OP(code, name, mode, cycles, flags, kind) [code] = my_op_##code,
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+int my6502_jit(struct my6502 *cpu, uint32_t threshold)
+{
+	struct my6502_jit *jit = cpu->jit;
+	unsigned int i;
+
+	if (jit) {
+		munmap(jit->arena, MY_JIT_ARENA_SZ);
+		free(jit);
+		cpu->jit = NULL;
+	}
+
+	if (cpu->blocks) {
+		for (i = 0; i < MY_BLOCK_CACHE_SZ; i++) {
+			cpu->blocks[i].code = NULL;
+		}
+	}
+
+	if (!threshold) {
+		return 0;
+	}
+
+	if (!cpu->blocks) {
+		return -1;
+	}
+
+	jit = malloc(sizeof(*jit));
+	if (!jit) {
+		return -1;
+	}
+
+	jit->arena = mmap(NULL, MY_JIT_ARENA_SZ,
+	                  PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->arena == MAP_FAILED) {
+		free(jit);
+		return -1;
+	}
+
+	jit->threshold = threshold;
+	jit->used = 0;
+	cpu->jit = jit;
+	return 0;
+}
+
+static uint8_t *my_emit(uint8_t *p, const void *bytes, size_t n)
+{
+	memcpy(p, bytes, n);
+	return p + n;
+}
+
+static uint8_t *my_emit_imm32(uint8_t *p, uint32_t imm)
+{
+	return my_emit(p, &imm, sizeof(imm));
+}
+
+/* Longest code for a single instruction below. */
+#define MY_JIT_INSN_SZ 48
+
+static void my_jit_compile(struct my6502 *cpu, struct my6502_block *block)
+{
+	struct my6502_jit *jit = cpu->jit;
+	uint8_t *exits[MY_BLOCK_MAX * 2];
+	unsigned int exit_count = 0;
+	uint8_t *start, *p;
+	unsigned int i;
+	uint64_t handler;
+	int32_t rel;
+
+	if (jit->used + 32 + MY_JIT_INSN_SZ * block->count > MY_JIT_ARENA_SZ) {
+		/* Start over, the interpreter is not in any of it now. */
+		for (i = 0; i < MY_BLOCK_CACHE_SZ; i++) {
+			cpu->blocks[i].code = NULL;
+		}
+		jit->used = 0;
+	}
+
+	if (mprotect(jit->arena, MY_JIT_ARENA_SZ, PROT_READ | PROT_WRITE)) {
+		return;
+	}
+
+	start = p = jit->arena + jit->used;
+
+	/* push rbx; push r12; sub rsp, 8; mov rbx, rdi; mov r12d, esi */
+	p = my_emit(p, "\x53\x41\x54\x48\x83\xEC\x08\x48\x89\xFB\x41\x89\xF4",
+	            13);
+
+	for (i = 0; i < block->count; i++) {
+		const struct my_insn *insn = &block->insns[i];
+
+		handler = (uint64_t)(uintptr_t)my_ops[insn->opcode];
+
+		/* mov rdi, rbx; mov esi, operand */
+		p = my_emit(p, "\x48\x89\xDF\xBE", 4);
+		p = my_emit_imm32(p, insn->operand);
+		/* mov rax, handler; call rax */
+		p = my_emit(p, "\x48\xB8", 2);
+		p = my_emit(p, &handler, sizeof(handler));
+		p = my_emit(p, "\xFF\xD0", 2);
+
+		if (i + 1 == block->count) {
+			break;
+		}
+
+		/* sub r12d, 1; jz exit */
+		p = my_emit(p, "\x41\x83\xEC\x01\x0F\x84", 6);
+		p = my_emit_imm32(p, 0);
+		exits[exit_count++] = p;
+		/* cmp byte [rbx + block_flushed], 0; jne exit */
+		p = my_emit(p, "\x80\xBB", 2);
+		p = my_emit_imm32(p, offsetof(struct my6502, block_flushed));
+		p = my_emit(p, "\x00\x0F\x85", 3);
+		p = my_emit_imm32(p, 0);
+		exits[exit_count++] = p;
+	}
+
+	/* The last instruction used up one more. */
+	p = my_emit(p, "\x41\x83\xEC\x01", 4);
+
+	for (i = 0; i < exit_count; i++) {
+		rel = p - exits[i];
+		memcpy(exits[i] - 4, &rel, sizeof(rel));
+	}
+
+	/* mov eax, r12d; add rsp, 8; pop r12; pop rbx; ret */
+	p = my_emit(p, "\x44\x89\xE0\x48\x83\xC4\x08\x41\x5C\x5B\xC3", 11);
+
+	jit->used += p - start;
+	if (!mprotect(jit->arena, MY_JIT_ARENA_SZ, PROT_READ | PROT_EXEC)) {
+		block->code = start;
+	}
+}
+
+/* Run a compiled block if there is one, compiling it once it's hot.
+ * Return the number of instructions executed, zero if none. */
+static uint32_t my_jit_run(struct my6502 *cpu, struct my6502_block *block,
+                           uint64_t budget, enum my6502_stop *stop)
+{
+	uint16_t last_pc;
+	uint8_t count = block->count;
+	uint32_t n;
+	unsigned int i;
+
+	if (!block->code) {
+		if (++block->hits < cpu->jit->threshold) {
+			return 0;
+		}
+		my_jit_compile(cpu, block);
+		if (!block->code) {
+			return 0;
+		}
+	}
+
+	if (budget > UINT32_MAX) {
+		budget = UINT32_MAX;
+	}
+
+	/* Only the last instruction of a block can trap. */
+	last_pc = block->pc;
+	for (i = 0; i + 1 < count; i++) {
+		last_pc += block->insns[i].size;
+	}
+
+	cpu->block_flushed = 0;
+	n = budget - ((my_jit_code)block->code)(cpu, budget);
+	if (n == count) {
+		my_stopped(cpu, last_pc, stop);
+	} else {
+		my_event_due(cpu, stop);
+	}
+
+	return n;
+}
+
+#else
+
+int my6502_jit(struct my6502 *cpu, uint32_t threshold)
+{
+	(void)cpu;
+	return threshold ? -1 : 0;
+}
+
+#endif
+
+static enum my6502_stop my_run_blocks(struct my6502 *cpu,
+                                      uint64_t max_instructions)
+{
+	struct my6502_block *block;
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	uint64_t i = 0, lookups = 0, misses = 0;
+	uint16_t last_pc;
+	unsigned int j;
+#ifdef MY6502_JIT
+	uint32_t n;
+#endif
+
+	while (i < max_instructions) {
+		block = &cpu->blocks[cpu->pc & (MY_BLOCK_CACHE_SZ - 1)];
+		lookups++;
+		if (!block->count || block->pc != cpu->pc) {
+			my_decode_block(cpu, block, cpu->pc);
+			misses++;
+		}
+
+		if (!block->count) {
+			/* Not cacheable, run it the slow way. */
+			last_pc = cpu->pc;
+			my_step(cpu);
+			i++;
+			if (my_stopped(cpu, last_pc, &stop)) {
+				break;
+			}
+			continue;
+		}
+
+#ifdef MY6502_JIT
+		/* Breakpoints are only checked by the interpreter, and so is
+		 * the event deadline if a block might run past it. */
+		if (cpu->jit && !cpu->breakpoint_count
+			&& cpu->next_event > cpu->cycles + MY_BLOCK_MAX * 9) {
+			n = my_jit_run(cpu, block, max_instructions - i, &stop);
+			i += n;
+			if (stop != MY6502_STOP_BUDGET) {
+				break;
+			}
+			if (n) {
+				continue;
+			}
+		}
+#endif
+
+		cpu->block_flushed = 0;
+		for (j = 0; j < block->count && i < max_instructions; j++) {
+			last_pc = cpu->pc;
+			my_execute(cpu, &block->insns[j]);
+			i++;
+			if (my_stopped(cpu, last_pc, &stop)) {
+				goto out;
+			}
+
+			/* The rest of the block might be stale. */
+			if (cpu->block_flushed) {
+				break;
+			}
+		}
+	}
+
+out:
+	cpu->instructions += i;
+	if (cpu->metrics) {
+		my_metrics_add(&cpu->metrics->block_lookups, lookups);
+		my_metrics_add(&cpu->metrics->block_hits, lookups - misses);
+	}
+	return stop;
+}
+
+int my6502_set_hooks(struct my6502 *cpu, const struct my6502_hooks *hooks)
+{
+	struct my6502_pages *mapped = cpu->mapped;
+	int memory = hooks && (hooks->read || hooks->write);
+
+	if (memory && !mapped) {
+		mapped = malloc(sizeof(*mapped));
+		if (!mapped) {
+			return -1;
+		}
+		memcpy(mapped->read, cpu->read_pages, sizeof(mapped->read));
+		memcpy(mapped->write, cpu->write_pages, sizeof(mapped->write));
+		memset(cpu->read_pages, 0, sizeof(cpu->read_pages));
+		memset(cpu->write_pages, 0, sizeof(cpu->write_pages));
+		cpu->mapped = mapped;
+	} else if (!memory && mapped) {
+		memcpy(cpu->read_pages, mapped->read, sizeof(mapped->read));
+		memcpy(cpu->write_pages, mapped->write, sizeof(mapped->write));
+		cpu->mapped = NULL;
+		free(mapped);
+	}
+
+	memset(&cpu->hooks, 0, sizeof(cpu->hooks));
+	if (hooks) {
+		cpu->hooks = *hooks;
+	}
+	cpu->hooked = hooks != NULL;
+
+	return 0;
+}
+
+/* The instrumented copy of the run loops, taken while hooks are
+ * attached, so that the others don't check for them. */
+static enum my6502_stop my_run_hooked(struct my6502 *cpu,
+                                      uint64_t max_instructions)
+{
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	uint64_t i;
+	uint16_t last_pc;
+	uint8_t opcode;
+
+	for (i = 0; i < max_instructions; ) {
+		last_pc = cpu->pc;
+		opcode = my_step(cpu);
+		i++;
+
+		if (cpu->hooks.retired) {
+			cpu->hooks.retired(cpu->hooks.arg, cpu, last_pc, opcode);
+		}
+
+		if (my_stopped(cpu, last_pc, &stop)) {
+			break;
+		}
+	}
+
+	cpu->instructions += i;
+	if (cpu->hooks.stop) {
+		cpu->hooks.stop(cpu->hooks.arg, cpu, stop);
+	}
+
+	return stop;
+}
+
+#ifndef MY6502_THREADED
+
+static enum my6502_stop my_run(struct my6502 *cpu, uint64_t max_instructions)
+{
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	uint64_t i;
+	uint16_t last_pc;
+
+	if (cpu->blocks) {
+		return my_run_blocks(cpu, max_instructions);
+	}
+
+	for (i = 0; i < max_instructions; ) {
+		last_pc = cpu->pc;
+		my_step(cpu);
+		i++;
+
+		if (my_stopped(cpu, last_pc, &stop)) {
+			break;
+		}
+	}
+
+	cpu->instructions += i;
+	return stop;
+}
+
+#else
+
+/* Threaded code: every handler ends with its own copy of the dispatch,
+ * so the branch predictor sees one indirect jump per opcode instead of
+ * a single shared one. Uses labels as values, a GCC extension. */
+static enum my6502_stop my_run(struct my6502 *cpu, uint64_t max_instructions)
+{
+	static const void *const handlers[0x100] = {
+		[0 ... 0xFF] = &&invalid,
+#define OP(code, name, mode, cycles, flags, kind) [code] = &&op_##code,
+#include "my6502_opcodes.h"
+#undef OP
+	};
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	uint64_t i = 0;
+	uint16_t last_pc;
+	uint16_t operand;
+	uint8_t opcode;
+	MY_STATS_DECL(start);
+
+#define FETCH()								\
+	do {								\
+		last_pc = cpu->pc;					\
+		MY_STATS_START(cpu, start);				\
+		opcode = my_read(cpu, cpu->pc++);			\
+		goto *handlers[opcode];					\
+	} while (0)
+
+	/* The same checks as in the switch-based loop above. */
+#define NEXT()								\
+	do {								\
+		MY_STATS_END(cpu, opcode, start);			\
+		i++;							\
+		if (my_stopped(cpu, last_pc, &stop)			\
+		    || i == max_instructions) {				\
+			goto out;					\
+		}							\
+		FETCH();						\
+	} while (0)
+
+	if (cpu->blocks) {
+		return my_run_blocks(cpu, max_instructions);
+	}
+
+	if (!max_instructions) {
+		return MY6502_STOP_BUDGET;
+	}
+
+	FETCH();
+
+#define OP(code, name, mode, clocks, flags, kind)			\
+	op_##code:							\
+		MY_EXECUTE(clocks, name, mode, kind);			\
+		NEXT();
+#include "my6502_opcodes.h"
+#undef OP
+
+invalid:
+	assert(0);
+	stop = MY6502_STOP_TRAP;
+
+out:
+	cpu->instructions += i;
+	return stop;
+
+#undef NEXT
+#undef FETCH
+}
+
+#endif
+
+/* Hooks and metrics are only checked once per call. */
+enum my6502_stop my6502_run(struct my6502 *cpu, uint64_t max_instructions)
+{
+	enum my6502_stop stop;
+
+	cpu->idle_budget = max_instructions;
+
+	/* Whatever is due since the last run, e.g. an interrupt raised in
+	 * between, comes before the first instruction. */
+	if (my_event_due(cpu, &stop)) {
+		if (cpu->hooks.stop) {
+			cpu->hooks.stop(cpu->hooks.arg, cpu, stop);
+		}
+	} else if (cpu->hooked) {
+		stop = my_run_hooked(cpu, max_instructions);
+	} else {
+		stop = my_run(cpu, max_instructions);
+	}
+
+	if (cpu->metrics) {
+		atomic_store_explicit(&cpu->metrics->instructions,
+			cpu->instructions, memory_order_relaxed);
+		atomic_store_explicit(&cpu->metrics->cycles, cpu->cycles,
+			memory_order_relaxed);
+	}
+
+	return stop;
+}
+
+void my6502_set_metrics(struct my6502 *cpu, struct my6502_metrics *m)
+{
+	cpu->metrics = m;
+	if (!m) {
+		return;
+	}
+
+	atomic_store_explicit(&m->instructions, cpu->instructions,
+		memory_order_relaxed);
+	atomic_store_explicit(&m->cycles, cpu->cycles, memory_order_relaxed);
+	atomic_store_explicit(&m->block_lookups, 0, memory_order_relaxed);
+	atomic_store_explicit(&m->block_hits, 0, memory_order_relaxed);
+	atomic_store_explicit(&m->mmio, 0, memory_order_relaxed);
+	atomic_store_explicit(&m->callback_ns, 0, memory_order_relaxed);
+	m->start_ns = my_now_ns();
+	m->start_cycles = cpu->cycles;
+}
+
+/* The counters at a point in time, and the rates since attached. */
+struct my_metrics_sample {
+	uint64_t instructions;
+	uint64_t cycles;
+	uint64_t mmio;
+	double mhz;
+	double hit_rate;
+	double callback_seconds;
+};
+
+static void my_metrics_sample(const struct my6502_metrics *m,
+                              struct my_metrics_sample *s)
+{
+	uint64_t lookups, elapsed;
+
+	s->instructions = atomic_load_explicit(&m->instructions,
+		memory_order_relaxed);
+	s->cycles = atomic_load_explicit(&m->cycles, memory_order_relaxed);
+	s->mmio = atomic_load_explicit(&m->mmio, memory_order_relaxed);
+	lookups = atomic_load_explicit(&m->block_lookups,
+		memory_order_relaxed);
+	s->hit_rate = lookups ? (double)atomic_load_explicit(&m->block_hits,
+		memory_order_relaxed) / lookups : 0;
+	s->callback_seconds = atomic_load_explicit(&m->callback_ns,
+		memory_order_relaxed) / 1e9;
+
+	elapsed = my_now_ns() - m->start_ns;
+	s->mhz = elapsed ? (s->cycles - m->start_cycles) * 1e3 / elapsed : 0;
+}
+
+int my6502_metrics_json(const struct my6502_metrics *m, const char *cpu,
+                        char *buf, size_t size)
+{
+	struct my_metrics_sample s;
+
+	my_metrics_sample(m, &s);
+	return snprintf(buf, size, "{\"cpu\":\"%s\",\"instructions\":%llu,"
+		"\"cycles\":%llu,\"mhz\":%.3f,\"block_hit_rate\":%.4f,"
+		"\"mmio\":%llu,\"callback_seconds\":%.6f}\n", cpu,
+		(unsigned long long)s.instructions,
+		(unsigned long long)s.cycles, s.mhz, s.hit_rate,
+		(unsigned long long)s.mmio, s.callback_seconds);
+}
+
+int my6502_metrics_prometheus(const struct my6502_metrics *m,
+                              const char *cpu, char *buf, size_t size)
+{
+	struct my_metrics_sample s;
+
+	my_metrics_sample(m, &s);
+	return snprintf(buf, size,
+		"# TYPE my6502_instructions_total counter\n"
+		"my6502_instructions_total{cpu=\"%s\"} %llu\n"
+		"# TYPE my6502_cycles_total counter\n"
+		"my6502_cycles_total{cpu=\"%s\"} %llu\n"
+		"# TYPE my6502_mhz gauge\n"
+		"my6502_mhz{cpu=\"%s\"} %.3f\n"
+		"# TYPE my6502_block_hit_ratio gauge\n"
+		"my6502_block_hit_ratio{cpu=\"%s\"} %.4f\n"
+		"# TYPE my6502_mmio_total counter\n"
+		"my6502_mmio_total{cpu=\"%s\"} %llu\n"
+		"# TYPE my6502_callback_seconds_total counter\n"
+		"my6502_callback_seconds_total{cpu=\"%s\"} %.6f\n",
+		cpu, (unsigned long long)s.instructions,
+		cpu, (unsigned long long)s.cycles,
+		cpu, s.mhz,
+		cpu, s.hit_rate,
+		cpu, (unsigned long long)s.mmio,
+		cpu, s.callback_seconds);
 }
@@ -0,0 +1,341 @@
+#ifndef MY6502_H
+#define MY6502_H
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef MY6502_STATS
+#include <stdio.h>
+#endif
+
+/* Memory bus. The user pointer of the CPU is passed to the callbacks
+ * as is, so a single bus can be shared by many CPUs. */
+struct my6502_bus {
+	uint8_t (*read)(void *user, uint16_t address);
+	void (*write)(void *user, uint16_t address, uint8_t value);
+};
+
+#define MY6502_MAX_BREAKPOINTS 8
+
+/* Scheduled event, see my6502_schedule(). */
+#define MY6502_MAX_EVENTS 32
+
+struct my6502;
+
+struct my6502_event {
+	uint64_t cycles;
+	/* Scheduling order, to fire events due at the same cycle in it. */
+	uint64_t seq;
+	void (*fn)(struct my6502 *cpu, void *arg);
+	void *arg;
+};
+
+/* See my6502_block_cache() and my6502_jit(). */
+struct my6502_block;
+struct my6502_jit;
+
+#ifdef MY6502_STATS
+/* Executed instructions and their cycles per opcode. */
+struct my6502_stats {
+	uint64_t count[0x100];
+	uint64_t cycles[0x100];
+};
+#endif
+
+#ifdef MY6502_PROFILE
+/* Shadow call stack entry, the subroutine address and the stack
+ * pointer right after the call. */
+#define MY6502_CALL_DEPTH 64
+
+struct my6502_call {
+	uint16_t entry;
+	uint8_t sp;
+};
+#endif
+
+/* Reasons for my6502_run() to return. */
+enum my6502_stop {
+	/* The instruction budget is exhausted. */
+	MY6502_STOP_BUDGET,
+	/* The last instruction didn't change PC, i.e. "jmp *", and there
+	 * is no scheduled event to wait for. */
+	MY6502_STOP_TRAP,
+	/* PC has reached an address set with my6502_set_breakpoint(). */
+	MY6502_STOP_BREAKPOINT,
+	/* Cycles have reached the deadline of my6502_set_next_event(). */
+	MY6502_STOP_EVENT,
+};
+
+/* Instrumentation, see my6502_set_hooks(). Any hook may be NULL, arg
+ * is passed to all of them as is. */
+struct my6502_hooks {
+	/* After every instruction, with its address and opcode. */
+	void (*retired)(void *arg, struct my6502 *cpu, uint16_t pc,
+	                uint8_t opcode);
+	/* Every memory access, fetches and stack included. */
+	void (*read)(void *arg, uint16_t address, uint8_t value);
+	void (*write)(void *arg, uint16_t address, uint8_t value);
+	/* Before an interrupt is taken, with the address of its vector. */
+	void (*interrupt)(void *arg, struct my6502 *cpu, uint16_t vector);
+	/* When my6502_run() returns, with the reason. */
+	void (*stop)(void *arg, struct my6502 *cpu, enum my6502_stop stop);
+	void *arg;
+};
+
+/* Counters for other threads to read while the CPU runs, see
+ * my6502_set_metrics(). Only the thread running the CPU writes them,
+ * with relaxed atomics. */
+struct my6502_metrics {
+	/* As of the last return from my6502_run(). */
+	_Atomic uint64_t instructions;
+	_Atomic uint64_t cycles;
+	/* Blocks looked up in the block cache, and those found decoded. */
+	_Atomic uint64_t block_lookups;
+	_Atomic uint64_t block_hits;
+	/* Bus callbacks made, and the time spent in them and in scheduled
+	 * events. */
+	_Atomic uint64_t mmio;
+	_Atomic uint64_t callback_ns;
+	/* When attached, for the clock rate. */
+	uint64_t start_ns;
+	uint64_t start_cycles;
+};
+
+/* The page mapping while memory hooks are attached. */
+struct my6502_pages;
+
+/* Flags for my6502_map(). */
+#define MY6502_MAP_READ   (1 << 0)
+#define MY6502_MAP_WRITE  (1 << 1)
+/* Read mem, which may be shared by many CPUs, until the first write to
+ * a page copies it to a page of the CPU's own. */
+#define MY6502_MAP_COW    (1 << 2)
+
+/* CPU context. The state is self-contained, so any number of CPUs
+ * can run in parallel as long as each one is used by a single thread
+ * at a time. */
+struct my6502 {
+	/* Registers. Use my6502_get_sr() and my6502_set_sr() to access
+	 * the status register. */
+	uint16_t pc;
+	uint8_t ac, x, y, sr, sp;
+
+	/* With MY6502_LAZY_FLAGS, the sources of N, Z and C which
+	 * are not kept in sr then. */
+	uint8_t n_result, z_result, carry;
+
+	/* Total number of instructions retired and clock cycles
+	 * spent so far. */
+	uint64_t instructions;
+	uint64_t cycles;
+
+	/* Set by indexed addressing for the page crossing penalty. */
+	uint8_t page_crossed;
+
+	const struct my6502_bus *bus;
+	void *user;
+
+	/* Per-page dispatch indexed by the high byte of the address.
+	 * A page is either mapped directly to host memory or, when the
+	 * pointer is NULL, it goes through the bus callbacks. */
+	const uint8_t *read_pages[0x100];
+	uint8_t *write_pages[0x100];
+
+	/* Pages mapped with MY6502_MAP_COW, set once copied. The copy is
+	 * mapped for both reads and writes then, cow_copies counts them.
+	 * cow_dirty lists those written since my6502_cow_revert(), which
+	 * maps the rest for reads only. */
+	uint8_t cow_pages[0x100];
+	unsigned int cow_copies;
+	uint8_t cow_dirty[0x100];
+	unsigned int cow_dirty_count;
+
+	/* See my6502_set_breakpoint(). */
+	uint16_t breakpoints[MY6502_MAX_BREAKPOINTS];
+	unsigned int breakpoint_count;
+
+	/* See my6502_block_cache(). Pages holding cached code are
+	 * flagged to catch writes to them. */
+	struct my6502_block *blocks;
+	uint8_t code_pages[0x100];
+	/* Set to leave the block being run after the current instruction,
+	 * because it was dropped or an interrupt is due. */
+	uint8_t block_flushed;
+	struct my6502_jit *jit;
+
+	/* Min-heap of scheduled events, see my6502_schedule(). */
+	struct my6502_event events[MY6502_MAX_EVENTS];
+	unsigned int event_count;
+	uint64_t event_seq;
+
+	/* Interrupt lines, see my6502_irq() and my6502_nmi(). */
+	uint8_t irq_lines;
+	uint8_t nmi_pending;
+
+	/* The only thing run loops check per instruction: the earliest of
+	 * the scheduled events, the deadline and pending interrupts. */
+	uint64_t next_event;
+	uint64_t deadline;
+
+	/* See my6502_idle_skip(). The state at the previous iteration of
+	 * a loop. */
+	uint8_t idle_skip;
+	uint16_t idle_pc;
+	uint8_t idle_ac, idle_x, idle_y, idle_sr;
+	uint64_t idle_cycles;
+	uint64_t idle_budget;
+
+	/* See my6502_set_hooks(). With memory hooks, read_pages and
+	 * write_pages are all NULL, so that every access takes the slow
+	 * path, and the mapping is kept in mapped instead. */
+	uint8_t hooked;
+	struct my6502_hooks hooks;
+	struct my6502_pages *mapped;
+
+	/* See my6502_set_metrics(). */
+	struct my6502_metrics *metrics;
+
+#ifdef MY6502_STATS
+	struct my6502_stats stats;
+#endif
+
+#ifdef MY6502_PROFILE
+	/* Calls made by JSR and BRK and not returned from yet, innermost
+	 * last. Only the first MY6502_CALL_DEPTH are kept. */
+	struct my6502_call calls[MY6502_CALL_DEPTH];
+	unsigned int call_depth;
+#endif
+};
+
+/* Zero the context and attach it to the bus. All pages are unmapped,
+ * i.e. every access goes through the bus callbacks. */
+void my6502_init(struct my6502 *cpu, const struct my6502_bus *bus,
+                 void *user);
+
+/* Map size bytes at a page-aligned address directly to mem for reads,
+ * writes or both, bypassing the bus callbacks. Mapping with no flags
+ * returns the pages to the callbacks. Mapping pages again frees their
+ * copies made by MY6502_MAP_COW, e.g. mapping mem with it again drops
+ * the changes. */
+void my6502_map(struct my6502 *cpu, uint16_t address, uint32_t size,
+                uint8_t *mem, int flags);
+
+/* Copy the pages copied by MY6502_MAP_COW back from their images, but
+ * keep the copies for the next writes. Along with the registers, it
+ * returns an instance to where it was when mapped, at the cost of the
+ * pages written since the last revert only. */
+void my6502_cow_revert(struct my6502 *cpu);
+
+/* Access memory as the CPU does, through the bus if not mapped, e.g.
+ * to set up or inspect an instance with MY6502_MAP_COW pages. */
+uint8_t my6502_peek(struct my6502 *cpu, uint16_t address);
+void my6502_poke(struct my6502 *cpu, uint16_t address, uint8_t value);
+
+void my6502_reset(struct my6502 *cpu, uint16_t pc);
+
+/* Make my6502_run() stop after the instruction that takes the cycle
+ * count to the deadline or past it, or before any if it's there
+ * already. UINT64_MAX, the default, never stops. */
+void my6502_set_next_event(struct my6502 *cpu, uint64_t cycles);
+
+/* Call fn(cpu, arg) once the cycle count reaches cycles, between
+ * instructions of my6502_run(). Events may schedule more events and
+ * raise the interrupt lines. Return -1 if MY6502_MAX_EVENTS are
+ * scheduled already. */
+int my6502_schedule(struct my6502 *cpu, uint64_t cycles,
+                    void (*fn)(struct my6502 *cpu, void *arg), void *arg);
+
+/* Drop the scheduled events calling fn with arg. */
+void my6502_cancel(struct my6502 *cpu,
+                   void (*fn)(struct my6502 *cpu, void *arg), void *arg);
+
+/* Set or clear one of 8 wired-OR IRQ lines. The IRQ is taken
+ * before the next instruction of my6502_run() for as long as a line
+ * is set and the I flag is clear. */
+void my6502_irq(struct my6502 *cpu, unsigned int line, int asserted);
+
+/* Signal an NMI edge, taken before the next instruction of
+ * my6502_run(). */
+void my6502_nmi(struct my6502 *cpu);
+
+/* Skip the iterations of idle loops up to the next event, see
+ * my6502_set_next_event() and my6502_schedule(). Only valid if whatever
+ * such a loop polls changes at events and nowhere else. Skipped
+ * instructions count in the instructions counter but not in the
+ * budget of my6502_run(), and there are never more of them than that
+ * budget. Nothing is skipped without an event or a deadline. */
+void my6502_idle_skip(struct my6502 *cpu, int enable);
+
+uint8_t my6502_get_sr(const struct my6502 *cpu);
+void my6502_set_sr(struct my6502 *cpu, uint8_t sr);
+
+/* Return the instruction size in bytes, zero for unknown opcodes. */
+unsigned int my6502_insn_size(uint8_t opcode);
+
+/* Return the cycles an opcode takes, with MY6502_PAGE_CYCLE set if
+ * it takes one more when indexing crosses a page, zero for unknown
+ * opcodes. */
+#define MY6502_PAGE_CYCLE 0x80
+
+unsigned int my6502_insn_cycles(uint8_t opcode);
+
+/* Return the status register bits an opcode may change, as laid out
+ * by my6502_get_sr(). */
+unsigned int my6502_insn_flags(uint8_t opcode);
+
+/* Disassemble the instruction at pc from its three bytes into buf,
+ * e.g. "LDA ($10),Y". Return the instruction size, one for unknown
+ * opcodes shown as ".byte". */
+unsigned int my6502_disasm(uint16_t pc, const uint8_t *bytes, char *buf,
+                           size_t size);
+
+/* Execute a single instruction. */
+void my6502_step(struct my6502 *cpu);
+
+/* Execute up to max_instructions instructions, stopping early on
+ * a trap or a breakpoint. The trapping instruction is executed once,
+ * a breakpoint is reported before the instruction at its address. */
+enum my6502_stop my6502_run(struct my6502 *cpu, uint64_t max_instructions);
+
+/* Return -1 if there are MY6502_MAX_BREAKPOINTS already. */
+int my6502_set_breakpoint(struct my6502 *cpu, uint16_t address, int enable);
+
+/* Attach hooks, or detach them with NULL. While attached,
+ * my6502_run() runs an instrumented copy of its loop, one instruction
+ * at a time without the block cache, and the memory hooks see
+ * my6502_step(), my6502_peek() and my6502_poke() as well; detached,
+ * they cost nothing. Return -1 if out of memory. */
+int my6502_set_hooks(struct my6502 *cpu, const struct my6502_hooks *hooks);
+
+/* Publish counters to m, or stop with NULL. Timing the bus callbacks
+ * and the events takes two clock reads each, the rest is only updated
+ * when my6502_run() returns. */
+void my6502_set_metrics(struct my6502 *cpu, struct my6502_metrics *m);
+
+/* Format the counters as a JSON line, or as Prometheus text with cpu
+ * as the label, e.g. from another thread every so often. Return what
+ * snprintf() does. */
+int my6502_metrics_json(const struct my6502_metrics *m, const char *cpu,
+                        char *buf, size_t size);
+int my6502_metrics_prometheus(const struct my6502_metrics *m,
+                              const char *cpu, char *buf, size_t size);
+
+/* Make my6502_run() execute cached pre-decoded basic blocks of code
+ * from pages mapped for reads. Code modified through the CPU or
+ * remapped with my6502_map() is decoded again. Code modified behind
+ * the back of the CPU requires re-enabling the cache. Disabling
+ * frees the cache. Return -1 if out of memory. */
+int my6502_block_cache(struct my6502 *cpu, int enable);
+
+/* With MY6502_JIT on x86-64, translate cached blocks to host code
+ * after they have been entered threshold times. Requires the block
+ * cache, disabling the cache disables the translation as well. Zero
+ * threshold disables it. Return -1 if out of memory. */
+int my6502_jit(struct my6502 *cpu, uint32_t threshold);
+
+#ifdef MY6502_STATS
+/* Print the counters per opcode, hottest first, then per addressing
+ * mode. */
+void my6502_dump_stats(const struct my6502 *cpu, FILE *f);
+#endif
+
+#endif
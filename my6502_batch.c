@@ -0,0 +1,953 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "my6502_batch.h"
+#include "my6502_internal.h"
+
+/* A chunk of lanes as a GCC vector, which the compiler maps to whatever
+ * SIMD the target has. Comparisons give 0 or -1 in each lane. */
+typedef uint8_t my_u8 __attribute__((vector_size(MY6502_BATCH_CHUNK)));
+typedef int8_t my_s8 __attribute__((vector_size(MY6502_BATCH_CHUNK)));
+typedef uint16_t my_u16 __attribute__((vector_size(MY6502_BATCH_CHUNK * 2)));
+typedef int16_t my_s16 __attribute__((vector_size(MY6502_BATCH_CHUNK * 2)));
+typedef uint32_t my_u32 __attribute__((vector_size(MY6502_BATCH_CHUNK * 4)));
+typedef uint64_t my_u64 __attribute__((vector_size(MY6502_BATCH_CHUNK * 8)));
+
+/* The helpers taking and returning them are all inlined, so there's no
+ * ABI to be warned about. */
+#if !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+/* An instance run on my6502 for a single instruction has its RAM on
+ * the bus, that's cheaper than copying it out. */
+static uint8_t my_batch_read(void *user, uint16_t address)
+{
+	struct my6502_batch *b = user;
+
+	return my6502_batch_peek(b, b->lane, address);
+}
+
+static void my_batch_write(void *user, uint16_t address, uint8_t value)
+{
+	struct my6502_batch *b = user;
+
+	my6502_batch_poke(b, b->lane, address, value);
+}
+
+static const struct my6502_bus my_batch_bus = {
+	my_batch_read,
+	my_batch_write,
+};
+
+/* What the lanes do for an opcode. The rest, BRK, RTI and JMP with an
+ * indirect address, run on my6502. */
+enum my_kind {
+	MY_NONE,
+	MY_ADC, MY_AND, MY_ASL, MY_BIT, MY_BRANCH, MY_CLC, MY_CLD, MY_CLI,
+	MY_CLV, MY_CMP, MY_CPX, MY_CPY, MY_DEC, MY_DEX, MY_DEY, MY_EOR,
+	MY_INC, MY_INX, MY_INY, MY_JMP, MY_JSR, MY_LDA, MY_LDX, MY_LDY,
+	MY_LSR, MY_NOP, MY_ORA, MY_PHA, MY_PHP, MY_PLA, MY_PLP, MY_ROL,
+	MY_ROR, MY_RTS, MY_SBC, MY_SEC, MY_SED, MY_SEI, MY_STA, MY_STX,
+	MY_STY, MY_TAX, MY_TAY, MY_TSX, MY_TXA, MY_TXS, MY_TYA,
+};
+
+/* The kind per mnemonic of the opcode table, which has to name them
+ * all. */
+#define MY_KIND_adc MY_ADC
+#define MY_KIND_and MY_AND
+#define MY_KIND_asl MY_ASL
+#define MY_KIND_bcc MY_BRANCH
+#define MY_KIND_bcs MY_BRANCH
+#define MY_KIND_beq MY_BRANCH
+#define MY_KIND_bit MY_BIT
+#define MY_KIND_bmi MY_BRANCH
+#define MY_KIND_bne MY_BRANCH
+#define MY_KIND_bpl MY_BRANCH
+#define MY_KIND_brk MY_NONE
+#define MY_KIND_bvc MY_BRANCH
+#define MY_KIND_bvs MY_BRANCH
+#define MY_KIND_clc MY_CLC
+#define MY_KIND_cld MY_CLD
+#define MY_KIND_cli MY_CLI
+#define MY_KIND_clv MY_CLV
+#define MY_KIND_cmp MY_CMP
+#define MY_KIND_cpx MY_CPX
+#define MY_KIND_cpy MY_CPY
+#define MY_KIND_dec MY_DEC
+#define MY_KIND_dex MY_DEX
+#define MY_KIND_dey MY_DEY
+#define MY_KIND_eor MY_EOR
+#define MY_KIND_inc MY_INC
+#define MY_KIND_inx MY_INX
+#define MY_KIND_iny MY_INY
+#define MY_KIND_jmp MY_JMP
+#define MY_KIND_jsr MY_JSR
+#define MY_KIND_lda MY_LDA
+#define MY_KIND_ldx MY_LDX
+#define MY_KIND_ldy MY_LDY
+#define MY_KIND_lsr MY_LSR
+#define MY_KIND_nop MY_NOP
+#define MY_KIND_ora MY_ORA
+#define MY_KIND_pha MY_PHA
+#define MY_KIND_php MY_PHP
+#define MY_KIND_pla MY_PLA
+#define MY_KIND_plp MY_PLP
+#define MY_KIND_rol MY_ROL
+#define MY_KIND_ror MY_ROR
+#define MY_KIND_rti MY_NONE
+#define MY_KIND_rts MY_RTS
+#define MY_KIND_sbc MY_SBC
+#define MY_KIND_sec MY_SEC
+#define MY_KIND_sed MY_SED
+#define MY_KIND_sei MY_SEI
+#define MY_KIND_sta MY_STA
+#define MY_KIND_stx MY_STX
+#define MY_KIND_sty MY_STY
+#define MY_KIND_tax MY_TAX
+#define MY_KIND_tay MY_TAY
+#define MY_KIND_tsx MY_TSX
+#define MY_KIND_txa MY_TXA
+#define MY_KIND_txs MY_TXS
+#define MY_KIND_tya MY_TYA
+
+/* Kind and addressing mode per opcode, MY_NONE for unknown opcodes. */
+static const struct {
+	uint8_t kind;
+	uint8_t mode;
+} my_lane_ops[0x100] = {
+#define OP(code, name, mode, cycles, flags, kind) \
+	[code] = { MY_KIND_##name, mode },
+#include "my6502_opcodes.h"
+#undef OP
+};
+
+/* Arrays are aligned for the widest chunk. */
+#define MY_ALIGN sizeof(my_u64)
+
+static void *my_batch_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + MY_ALIGN - 1) & ~(MY_ALIGN - 1);
+	p = aligned_alloc(MY_ALIGN, size);
+	if (p) {
+		memset(p, 0, size);
+	}
+	return p;
+}
+
+int my6502_batch_init(struct my6502_batch *b, unsigned int count)
+{
+	unsigned int i;
+
+	memset(b, 0, sizeof(*b));
+	b->count = count;
+	b->lanes = (count + MY6502_BATCH_CHUNK - 1) & ~(MY6502_BATCH_CHUNK - 1);
+	if (!b->lanes) {
+		b->lanes = MY6502_BATCH_CHUNK;
+	}
+
+	b->pc = my_batch_alloc(b->lanes * sizeof(*b->pc));
+	b->ac = my_batch_alloc(b->lanes);
+	b->x = my_batch_alloc(b->lanes);
+	b->y = my_batch_alloc(b->lanes);
+	b->sp = my_batch_alloc(b->lanes);
+	b->sr = my_batch_alloc(b->lanes);
+	b->cycles = my_batch_alloc(b->lanes * sizeof(*b->cycles));
+	b->instructions = my_batch_alloc(b->lanes * sizeof(*b->instructions));
+	b->done = my_batch_alloc(b->lanes);
+	b->stop = my_batch_alloc(b->lanes);
+	b->mask = my_batch_alloc(b->lanes);
+	b->addr = my_batch_alloc(b->lanes * sizeof(*b->addr));
+	b->value = my_batch_alloc(b->lanes);
+	b->cross = my_batch_alloc(b->lanes);
+	b->mem = my_batch_alloc((size_t)b->lanes << 16);
+	b->copy = my_batch_alloc(0x10000);
+	if (!b->pc || !b->ac || !b->x || !b->y || !b->sp || !b->sr
+		|| !b->cycles || !b->instructions || !b->done || !b->stop
+		|| !b->mask || !b->addr || !b->value || !b->cross || !b->mem
+		|| !b->copy) {
+		my6502_batch_free(b);
+		return -1;
+	}
+
+	for (i = 0; i < b->lanes; i++) {
+		if (i < count) {
+			my6502_batch_reset(b, i, 0);
+		} else {
+			b->done[i] = 1;
+		}
+	}
+
+	my6502_init(&b->cpu, &my_batch_bus, b);
+	return 0;
+}
+
+void my6502_batch_free(struct my6502_batch *b)
+{
+	free(b->pc);
+	free(b->ac);
+	free(b->x);
+	free(b->y);
+	free(b->sp);
+	free(b->sr);
+	free(b->cycles);
+	free(b->instructions);
+	free(b->done);
+	free(b->stop);
+	free(b->mask);
+	free(b->addr);
+	free(b->value);
+	free(b->cross);
+	free(b->mem);
+	free(b->copy);
+	memset(b, 0, sizeof(*b));
+}
+
+void my6502_batch_reset(struct my6502_batch *b, unsigned int i, uint16_t pc)
+{
+	/* See my6502_reset(). */
+	b->pc[i] = pc;
+	b->ac[i] = 0;
+	b->x[i] = 0;
+	b->y[i] = 0;
+	b->sp[i] = 0xFD;
+	b->sr[i] = SR_FLAG_UNUSED;
+	b->cycles[i] = 0;
+	b->instructions[i] = 0;
+	b->done[i] = 0;
+	b->stop[i] = MY6502_STOP_BUDGET;
+}
+
+uint8_t my6502_batch_peek(const struct my6502_batch *b, unsigned int i,
+                          uint16_t address)
+{
+	const uint8_t *rom = b->rom_pages[address >> 8];
+
+	return rom ? rom[address & 0xFF] : b->mem[(size_t)address * b->lanes + i];
+}
+
+void my6502_batch_poke(struct my6502_batch *b, unsigned int i,
+                       uint16_t address, uint8_t value)
+{
+	if (!b->rom_pages[address >> 8]) {
+		b->mem[(size_t)address * b->lanes + i] = value;
+	}
+}
+
+void my6502_batch_load(struct my6502_batch *b, uint16_t address,
+                       uint32_t size, const uint8_t *data)
+{
+	uint8_t *row = b->mem + (size_t)address * b->lanes;
+	uint32_t j;
+
+	assert(address + size <= 0x10000);
+
+	for (j = 0; j < size; j++, row += b->lanes) {
+		memset(row, data[j], b->lanes);
+	}
+}
+
+void my6502_batch_rom(struct my6502_batch *b, uint16_t address,
+                      uint32_t size, const uint8_t *rom)
+{
+	unsigned int i;
+
+	assert(!(address & 0xFF) && !(size & 0xFF));
+	assert((address >> 8) + (size >> 8) <= 0x100);
+
+	for (i = 0; i < (size >> 8); i++) {
+		b->rom_pages[(address >> 8) + i] = rom + (i << 8);
+	}
+	my6502_map(&b->cpu, address, size, (uint8_t *)rom, MY6502_MAP_READ);
+}
+
+/* Copy the RAM of an instance out of the rows and map it for my6502,
+ * or copy it back and unmap it. */
+static void my_batch_map(struct my6502_batch *b, unsigned int i, int flags)
+{
+	const size_t lanes = b->lanes;
+	unsigned int page, j;
+	uint8_t *row;
+
+	for (page = 0; page < 0x100; page++) {
+		if (b->rom_pages[page]) {
+			continue;
+		}
+		row = b->mem + (size_t)(page << 8) * lanes + i;
+		if (flags) {
+			for (j = 0; j < 0x100; j++) {
+				b->copy[page << 8 | j] = row[j * lanes];
+			}
+		} else {
+			for (j = 0; j < 0x100; j++) {
+				row[j * lanes] = b->copy[page << 8 | j];
+			}
+		}
+		my6502_map(&b->cpu, page << 8, 0x100, b->copy + (page << 8),
+			flags);
+	}
+}
+
+/* Run an instance on my6502 for up to count instructions. */
+static void my_batch_scalar(struct my6502_batch *b, unsigned int i,
+                            uint64_t count, uint64_t max_instructions)
+{
+	struct my6502 *cpu = &b->cpu;
+	enum my6502_stop stop;
+
+	b->lane = i;
+	if (count > 1) {
+		my_batch_map(b, i, MY6502_MAP_READ | MY6502_MAP_WRITE);
+	}
+	cpu->pc = b->pc[i];
+	cpu->ac = b->ac[i];
+	cpu->x = b->x[i];
+	cpu->y = b->y[i];
+	cpu->sp = b->sp[i];
+	my6502_set_sr(cpu, b->sr[i]);
+	cpu->cycles = b->cycles[i];
+	cpu->instructions = b->instructions[i];
+
+	if (count > max_instructions - b->instructions[i]) {
+		count = max_instructions - b->instructions[i];
+	}
+	stop = my6502_run(cpu, count);
+	if (count > 1) {
+		my_batch_map(b, i, 0);
+	}
+
+	b->pc[i] = cpu->pc;
+	b->ac[i] = cpu->ac;
+	b->x[i] = cpu->x;
+	b->y[i] = cpu->y;
+	b->sp[i] = cpu->sp;
+	b->sr[i] = my6502_get_sr(cpu);
+	b->cycles[i] = cpu->cycles;
+	b->instructions[i] = cpu->instructions;
+
+	if (stop == MY6502_STOP_TRAP) {
+		b->done[i] = 1;
+		b->stop[i] = MY6502_STOP_TRAP;
+	} else if (b->instructions[i] >= max_instructions) {
+		b->done[i] = 1;
+		b->stop[i] = MY6502_STOP_BUDGET;
+	}
+}
+
+#define MY_CHUNKS(b, c)							\
+	for (c = 0; c < (b)->lanes / MY6502_BATCH_CHUNK; c++)
+
+/* Lane operations on a chunk. The mask is 0xFF for the lanes taking
+ * part and 0 for the rest, which keep their registers. */
+static inline my_u8 my_blend(my_u8 mask, my_u8 value, my_u8 old)
+{
+	return (value & mask) | (old & ~mask);
+}
+
+static inline my_u8 my_nz(my_u8 sr, my_u8 value)
+{
+	sr &= ~(SR_FLAG_NEGATIVE | SR_FLAG_ZERO);
+	return sr | (value & SR_FLAG_NEGATIVE)
+		| ((my_u8)(value == 0) & SR_FLAG_ZERO);
+}
+
+static inline void my_lane_load(my_u8 *reg, my_u8 *sr, my_u8 mask,
+                                my_u8 value)
+{
+	*reg = my_blend(mask, value, *reg);
+	*sr = my_blend(mask, my_nz(*sr, value), *sr);
+}
+
+/* The carry out is the sum wrapping around, or adding up to the same
+ * with the carry in. */
+static inline void my_lane_adc(my_u8 *ac, my_u8 *sr, my_u8 mask,
+                               my_u8 value)
+{
+	my_u8 carry = *sr & SR_FLAG_CARRY;
+	my_u8 result = *ac + value + carry;
+	my_u8 flags;
+
+	flags = *sr & ~(SR_FLAG_OVERFLOW | SR_FLAG_CARRY);
+	flags |= (~(*ac ^ value) & (*ac ^ result) & 0x80) >> 1;
+	flags |= (my_u8)((result < *ac) | ((result == *ac) & (carry != 0)))
+		& SR_FLAG_CARRY;
+
+	*ac = my_blend(mask, result, *ac);
+	*sr = my_blend(mask, my_nz(flags, result), *sr);
+}
+
+static inline void my_lane_cmp(my_u8 reg, my_u8 *sr, my_u8 mask,
+                               my_u8 value)
+{
+	my_u8 flags = (*sr & ~SR_FLAG_CARRY)
+		| ((my_u8)(reg >= value) & SR_FLAG_CARRY);
+
+	*sr = my_blend(mask, my_nz(flags, reg - value), *sr);
+}
+
+static inline void my_lane_bit(my_u8 ac, my_u8 *sr, my_u8 mask,
+                               my_u8 value)
+{
+	my_u8 flags = *sr & ~(SR_FLAG_NEGATIVE | SR_FLAG_OVERFLOW
+		| SR_FLAG_ZERO);
+
+	flags |= value & (SR_FLAG_NEGATIVE | SR_FLAG_OVERFLOW);
+	flags |= (my_u8)((ac & value) == 0) & SR_FLAG_ZERO;
+	*sr = my_blend(mask, flags, *sr);
+}
+
+/* A shift or rotate with the carry out. */
+static inline void my_lane_shift(my_u8 *value, my_u8 *sr, my_u8 mask,
+                                 my_u8 result, my_u8 carry)
+{
+	my_u8 flags = (*sr & ~SR_FLAG_CARRY) | carry;
+
+	*value = my_blend(mask, result, *value);
+	*sr = my_blend(mask, my_nz(flags, result), *sr);
+}
+
+/* GCC does conversions more than twice as wide and comparisons wider
+ * than the SIMD registers one lane at a time. So conversions go a step
+ * at a time and 16-bit values are compared a byte at a time. */
+static inline my_u64 my_widen64(my_u8 value)
+{
+	return __builtin_convertvector(__builtin_convertvector(
+		__builtin_convertvector(value, my_u16), my_u32), my_u64);
+}
+
+/* The mask widened to the 16 and 64-bit lanes. */
+static inline my_u16 my_mask16(my_u8 mask)
+{
+	return (my_u16)__builtin_convertvector((my_s8)mask, my_s16);
+}
+
+static inline my_u64 my_mask64(my_u8 mask)
+{
+	return -my_widen64(mask & 1);
+}
+
+static inline my_u8 my_low(const my_u16 *value)
+{
+	return __builtin_convertvector(*value, my_u8);
+}
+
+static inline my_u8 my_high(const my_u16 *value)
+{
+	return __builtin_convertvector(*value >> 8, my_u8);
+}
+
+static inline my_u8 my_equal16(const my_u16 *value, uint16_t to)
+{
+	my_u16 diff = *value ^ to;
+
+	return (my_u8)((my_low(&diff) | my_high(&diff)) == 0);
+}
+
+/* The least value in a chunk. */
+static inline uint8_t my_least(my_u8 least)
+{
+	uint8_t min = 0xFF;
+	unsigned int i;
+
+	for (i = 0; i < MY6502_BATCH_CHUNK; i++) {
+		min = least[i] < min ? least[i] : min;
+	}
+	return min;
+}
+
+/* Keep the lesser of the values in the lanes of the mask. */
+static inline my_u8 my_lesser(my_u8 least, my_u8 mask, my_u8 value)
+{
+	my_u8 lt = (my_u8)(value < least) & mask;
+
+	return (value & lt) | (least & ~lt);
+}
+
+/* Move the lanes of the mask on to next or, where taken is set, to
+ * target, and count the cycles. */
+static inline void my_lane_jump(my_u16 *pc, my_u64 *cycles, my_u8 mask,
+                                my_u8 taken, uint16_t next, uint16_t target,
+                                const my_u64 *spent)
+{
+	my_u16 m = my_mask16(mask), t = my_mask16(mask & taken);
+
+	*pc = (*pc & ~m) | (next & m & ~t) | (target & t);
+	*cycles += *spent & my_mask64(mask);
+}
+
+/* The number of lanes set in a mask, over all the chunks. */
+static inline unsigned int my_count(const struct my6502_batch *b,
+                                    const uint8_t *mask)
+{
+	const my_u8 *m = (const my_u8 *)mask;
+	my_u16 sum = { 0 };
+	unsigned int c, i, count = 0;
+
+	MY_CHUNKS(b, c) sum += __builtin_convertvector(m[c] & 1, my_u16);
+	for (i = 0; i < MY6502_BATCH_CHUNK; i++) {
+		count += sum[i];
+	}
+	return count;
+}
+
+static inline int my_any(const my_u8 *v)
+{
+	uint64_t words[sizeof(*v) / 8], any = 0;
+	unsigned int i;
+
+	memcpy(words, v, sizeof(words));
+	for (i = 0; i < sizeof(*v) / 8; i++) {
+		any |= words[i];
+	}
+	return any != 0;
+}
+
+/* Memory of an instance, ROM included. */
+static inline uint8_t my_lane_read(const struct my6502_batch *b,
+                                   unsigned int i, uint16_t address)
+{
+	const uint8_t *rom = b->rom_pages[address >> 8];
+
+	return rom ? rom[address & 0xFF] : b->mem[(size_t)address * b->lanes + i];
+}
+
+static inline void my_lane_write(struct my6502_batch *b, unsigned int i,
+                                 uint16_t address, uint8_t value)
+{
+	if (!b->rom_pages[address >> 8]) {
+		b->mem[(size_t)address * b->lanes + i] = value;
+	}
+}
+
+/* Register work goes over all the lanes a chunk at a time, and so does
+ * memory at the same address in all, which is a row of bytes. Memory at
+ * addresses of their own is accessed one lane at a time, only in the
+ * lanes taking part. */
+#define MY_MASKED(b, i)							\
+	for (i = 0; i < (b)->count; i++)				\
+		if ((b)->mask[i])
+
+/* Execute the instruction at pc in the lanes of the mask. Return 0 if
+ * it can't be, and then the lanes must run on my6502. */
+static int my_batch_lanes(struct my6502_batch *b, uint16_t pc,
+                          const uint8_t *code)
+{
+	my_u8 *m = (my_u8 *)b->mask, *v = (my_u8 *)b->value;
+	my_u8 *cross = (my_u8 *)b->cross;
+	my_u8 *ac = (my_u8 *)b->ac, *x = (my_u8 *)b->x, *y = (my_u8 *)b->y;
+	my_u8 *sr = (my_u8 *)b->sr;
+	my_u16 *addr = (my_u16 *)b->addr, *pcs = (my_u16 *)b->pc, wide;
+	my_u64 *cyc = (my_u64 *)b->cycles, spent;
+	my_u8 *row, any = { 0 }, taken;
+	uint8_t op = code[0], lo = code[1];
+	unsigned int kind = my_lane_ops[op].kind;
+	unsigned int mode = my_lane_ops[op].mode;
+	unsigned int size = my6502_insn_size(op);
+	unsigned int cycles = my6502_insn_cycles(op);
+	uint16_t operand = size > 2 ? lo | code[2] << 8 : lo;
+	uint16_t next = pc + size;
+	uint16_t base, target;
+	my_u8 *sp = (my_u8 *)b->sp;
+	uint8_t flag, want;
+	unsigned int c, i;
+	int rows = mode == ABSOLUTE || mode == ZEROPAGE;
+
+	if (kind == MY_NONE || mode == INDIRECT) {
+		return 0;
+	}
+
+#ifndef MY6502_NES_CPU
+	if (kind == MY_ADC || kind == MY_SBC) {
+		MY_CHUNKS(b, c) any |= m[c] & sr[c] & SR_FLAG_DECIMAL;
+		if (my_any(&any)) {
+			return 0;
+		}
+	}
+#endif
+
+	/* Effective address, see my_read_addr(). Zero page and absolute
+	 * are the row at the operand. */
+	switch (mode) {
+	case ABSOLUTE_X:
+		MY_CHUNKS(b, c) {
+			addr[c] = __builtin_convertvector(x[c], my_u16) + operand;
+			wide = addr[c] ^ operand;
+			cross[c] = (my_u8)(my_high(&wide) != 0) & 1;
+		}
+		break;
+	case ABSOLUTE_Y:
+		MY_CHUNKS(b, c) {
+			addr[c] = __builtin_convertvector(y[c], my_u16) + operand;
+			wide = addr[c] ^ operand;
+			cross[c] = (my_u8)(my_high(&wide) != 0) & 1;
+		}
+		break;
+	case ZEROPAGE_X:
+		MY_CHUNKS(b, c) {
+			addr[c] = __builtin_convertvector((my_u8)(x[c] + lo),
+				my_u16);
+		}
+		break;
+	case ZEROPAGE_Y:
+		MY_CHUNKS(b, c) {
+			addr[c] = __builtin_convertvector((my_u8)(y[c] + lo),
+				my_u16);
+		}
+		break;
+	case INDIRECT_X:
+		MY_MASKED(b, i) {
+			base = (uint8_t)(lo + b->x[i]);
+			b->addr[i] = my_lane_read(b, i, base)
+				| my_lane_read(b, i, (uint8_t)(base + 1)) << 8;
+		}
+		break;
+	case INDIRECT_Y:
+		MY_MASKED(b, i) {
+			base = my_lane_read(b, i, lo)
+				| my_lane_read(b, i, (uint8_t)(lo + 1)) << 8;
+			b->addr[i] = base + b->y[i];
+			b->cross[i] = (b->addr[i] ^ base) > 0xFF;
+		}
+		break;
+	}
+	row = rows && !b->rom_pages[operand >> 8]
+		? (my_u8 *)(b->mem + (size_t)operand * b->lanes) : NULL;
+
+	/* Operand. */
+	switch (mode) {
+	case IMMEDIATE:
+		MY_CHUNKS(b, c) v[c] = (my_u8){ 0 } + lo;
+		break;
+	case ACCUMULATOR:
+		MY_CHUNKS(b, c) v[c] = ac[c];
+		break;
+	case IMPLIED:
+	case RELATIVE:
+		break;
+	default:
+		if (kind == MY_STA || kind == MY_STX || kind == MY_STY
+			|| kind == MY_JMP || kind == MY_JSR) {
+			break;
+		}
+		if (row) {
+			MY_CHUNKS(b, c) v[c] = row[c];
+		} else if (rows) {
+			MY_CHUNKS(b, c) {
+				v[c] = (my_u8){ 0 }
+					+ b->rom_pages[operand >> 8][lo];
+			}
+		} else {
+			MY_MASKED(b, i) {
+				b->value[i] = my_lane_read(b, i, b->addr[i]);
+			}
+		}
+		break;
+	}
+
+	switch (kind) {
+	case MY_LDA: MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], v[c]); break;
+	case MY_LDX: MY_CHUNKS(b, c) my_lane_load(&x[c], &sr[c], m[c], v[c]); break;
+	case MY_LDY: MY_CHUNKS(b, c) my_lane_load(&y[c], &sr[c], m[c], v[c]); break;
+	case MY_AND: MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], ac[c] & v[c]); break;
+	case MY_ORA: MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], ac[c] | v[c]); break;
+	case MY_EOR: MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], ac[c] ^ v[c]); break;
+	case MY_ADC: MY_CHUNKS(b, c) my_lane_adc(&ac[c], &sr[c], m[c], v[c]); break;
+	case MY_SBC: MY_CHUNKS(b, c) my_lane_adc(&ac[c], &sr[c], m[c], ~v[c]); break;
+	case MY_CMP: MY_CHUNKS(b, c) my_lane_cmp(ac[c], &sr[c], m[c], v[c]); break;
+	case MY_CPX: MY_CHUNKS(b, c) my_lane_cmp(x[c], &sr[c], m[c], v[c]); break;
+	case MY_CPY: MY_CHUNKS(b, c) my_lane_cmp(y[c], &sr[c], m[c], v[c]); break;
+	case MY_BIT: MY_CHUNKS(b, c) my_lane_bit(ac[c], &sr[c], m[c], v[c]); break;
+
+	case MY_ASL: MY_CHUNKS(b, c) my_lane_shift(&v[c], &sr[c], m[c], v[c] << 1, v[c] >> 7); break;
+	case MY_LSR: MY_CHUNKS(b, c) my_lane_shift(&v[c], &sr[c], m[c], v[c] >> 1, v[c] & 1); break;
+	case MY_ROL: MY_CHUNKS(b, c) my_lane_shift(&v[c], &sr[c], m[c], v[c] << 1 | (sr[c] & SR_FLAG_CARRY), v[c] >> 7); break;
+	case MY_ROR: MY_CHUNKS(b, c) my_lane_shift(&v[c], &sr[c], m[c], v[c] >> 1 | sr[c] << 7, v[c] & 1); break;
+	case MY_INC: MY_CHUNKS(b, c) my_lane_load(&v[c], &sr[c], m[c], v[c] + 1); break;
+	case MY_DEC: MY_CHUNKS(b, c) my_lane_load(&v[c], &sr[c], m[c], v[c] - 1); break;
+	case MY_STA: MY_CHUNKS(b, c) v[c] = ac[c]; break;
+	case MY_STX: MY_CHUNKS(b, c) v[c] = x[c]; break;
+	case MY_STY: MY_CHUNKS(b, c) v[c] = y[c]; break;
+
+	case MY_INX: MY_CHUNKS(b, c) my_lane_load(&x[c], &sr[c], m[c], x[c] + 1); break;
+	case MY_INY: MY_CHUNKS(b, c) my_lane_load(&y[c], &sr[c], m[c], y[c] + 1); break;
+	case MY_DEX: MY_CHUNKS(b, c) my_lane_load(&x[c], &sr[c], m[c], x[c] - 1); break;
+	case MY_DEY: MY_CHUNKS(b, c) my_lane_load(&y[c], &sr[c], m[c], y[c] - 1); break;
+	case MY_TAX: MY_CHUNKS(b, c) my_lane_load(&x[c], &sr[c], m[c], ac[c]); break;
+	case MY_TAY: MY_CHUNKS(b, c) my_lane_load(&y[c], &sr[c], m[c], ac[c]); break;
+	case MY_TXA: MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], x[c]); break;
+	case MY_TYA: MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], y[c]); break;
+	case MY_TSX: MY_CHUNKS(b, c) my_lane_load(&x[c], &sr[c], m[c], sp[c]); break;
+	case MY_TXS: MY_CHUNKS(b, c) sp[c] = my_blend(m[c], x[c], sp[c]); break;
+	case MY_CLC: MY_CHUNKS(b, c) sr[c] &= ~(m[c] & SR_FLAG_CARRY); break;
+	case MY_SEC: MY_CHUNKS(b, c) sr[c] |= m[c] & SR_FLAG_CARRY; break;
+	case MY_CLV: MY_CHUNKS(b, c) sr[c] &= ~(m[c] & SR_FLAG_OVERFLOW); break;
+	case MY_CLD: MY_CHUNKS(b, c) sr[c] &= ~(m[c] & SR_FLAG_DECIMAL); break;
+	case MY_SED: MY_CHUNKS(b, c) sr[c] |= m[c] & SR_FLAG_DECIMAL; break;
+	case MY_CLI: MY_CHUNKS(b, c) sr[c] &= ~(m[c] & SR_FLAG_INTERRUPT); break;
+	case MY_SEI: MY_CHUNKS(b, c) sr[c] |= m[c] & SR_FLAG_INTERRUPT; break;
+	case MY_NOP: break;
+
+	/* The stack, see my_push() and my_pop(). */
+	case MY_PHA:
+	case MY_PHP:
+		MY_MASKED(b, i) {
+			my_lane_write(b, i, 0x100 | b->sp[i]--, kind == MY_PHA
+				? b->ac[i] : b->sr[i] | SR_FLAG_BREAK);
+		}
+		break;
+	case MY_PLA:
+		MY_MASKED(b, i) {
+			b->value[i] = my_lane_read(b, i, 0x100 | ++b->sp[i]);
+		}
+		MY_CHUNKS(b, c) my_lane_load(&ac[c], &sr[c], m[c], v[c]);
+		break;
+	case MY_PLP:
+		MY_MASKED(b, i) {
+			b->sr[i] = my_lane_read(b, i, 0x100 | ++b->sp[i])
+				| SR_FLAG_UNUSED;
+		}
+		break;
+	case MY_JSR:
+		MY_MASKED(b, i) {
+			my_lane_write(b, i, 0x100 | b->sp[i]--, (next - 1) >> 8);
+			my_lane_write(b, i, 0x100 | b->sp[i]--, next - 1);
+		}
+		next = operand;
+		break;
+	case MY_RTS:
+		MY_MASKED(b, i) {
+			target = my_lane_read(b, i, 0x100 | ++b->sp[i]);
+			target |= my_lane_read(b, i, 0x100 | ++b->sp[i]) << 8;
+			b->pc[i] = target + 1;
+			b->cycles[i] += cycles;
+		}
+		return 1;
+	case MY_JMP:
+		next = operand;
+		break;
+
+	/* Each lane goes its own way, see my_branch(). */
+	case MY_BRANCH:
+		flag = (const uint8_t[]){ SR_FLAG_NEGATIVE, SR_FLAG_OVERFLOW,
+			SR_FLAG_CARRY, SR_FLAG_ZERO }[op >> 6];
+		want = op & 0x20 ? flag : 0;
+		target = next + (int8_t)lo;
+		MY_CHUNKS(b, c) {
+			taken = (my_u8)((sr[c] & flag) == want);
+			spent = cycles + my_widen64(taken & 1)
+				* (((next ^ target) > 0xFF) + 1);
+			my_lane_jump(&pcs[c], &cyc[c], m[c], taken, next, target,
+				&spent);
+		}
+		return 1;
+	}
+
+	/* Write back. */
+	switch (kind) {
+	case MY_ASL:
+	case MY_LSR:
+	case MY_ROL:
+	case MY_ROR:
+		if (mode == ACCUMULATOR) {
+			MY_CHUNKS(b, c) ac[c] = my_blend(m[c], v[c], ac[c]);
+			break;
+		}
+		/* fall through */
+	case MY_INC:
+	case MY_DEC:
+	case MY_STA:
+	case MY_STX:
+	case MY_STY:
+		if (row) {
+			MY_CHUNKS(b, c) row[c] = my_blend(m[c], v[c], row[c]);
+		} else if (!rows) {
+			MY_MASKED(b, i) {
+				my_lane_write(b, i, b->addr[i], b->value[i]);
+			}
+		}
+		break;
+	}
+
+	if (cycles & MY6502_PAGE_CYCLE) {
+		cycles &= ~MY6502_PAGE_CYCLE;
+		MY_CHUNKS(b, c) {
+			spent = cycles + my_widen64(cross[c]);
+			my_lane_jump(&pcs[c], &cyc[c], m[c], (my_u8){ 0 }, next,
+				next, &spent);
+		}
+	} else {
+		spent = (my_u64){ 0 } + cycles;
+		MY_CHUNKS(b, c) {
+			my_lane_jump(&pcs[c], &cyc[c], m[c], (my_u8){ 0 }, next,
+				next, &spent);
+		}
+	}
+
+	return 1;
+}
+
+/* The fewest instructions any running instance has left, see
+ * my_batch_retire(). */
+static void my_batch_horizon(struct my6502_batch *b,
+                             uint64_t max_instructions)
+{
+	unsigned int i;
+
+	b->horizon = UINT64_MAX;
+	for (i = 0; i < b->count; i++) {
+		if (!b->done[i] && max_instructions - b->instructions[i]
+			< b->horizon) {
+			b->horizon = max_instructions - b->instructions[i];
+		}
+	}
+}
+
+/* Count an instruction in the lanes of the mask, which were at pc.
+ * An instance runs at most one instruction per step, so none can reach
+ * the budget before the horizon is, and only then it's checked. */
+static void my_batch_retire(struct my6502_batch *b, uint16_t pc,
+                            uint64_t max_instructions)
+{
+	my_u8 *m = (my_u8 *)b->mask;
+	my_u8 *done = (my_u8 *)b->done, *stop = (my_u8 *)b->stop;
+	my_u16 *pcs = (my_u16 *)b->pc;
+	my_u64 *instructions = (my_u64 *)b->instructions;
+	my_u8 trap;
+	unsigned int c, i;
+
+	MY_CHUNKS(b, c) {
+		trap = m[c] & my_equal16(&pcs[c], pc);
+		instructions[c] += my_mask64(m[c]) & 1;
+		done[c] |= trap & 1;
+		stop[c] = my_blend(trap, (my_u8){ 0 } + MY6502_STOP_TRAP,
+			stop[c]);
+	}
+	if (b->horizon) {
+		return;
+	}
+
+	MY_MASKED(b, i) {
+		if (!b->done[i] && b->instructions[i] >= max_instructions) {
+			b->done[i] = 1;
+			b->stop[i] = MY6502_STOP_BUDGET;
+		}
+	}
+	my_batch_horizon(b, max_instructions);
+}
+
+/* Execute the instruction at the lowest PC of the running instances,
+ * so that instances behind catch up with the rest. Return 0 once all
+ * are done. */
+static int my_batch_step(struct my6502_batch *b, uint64_t max_instructions)
+{
+	my_u8 *m = (my_u8 *)b->mask, *diff = (my_u8 *)b->value;
+	const my_u8 *done = (const my_u8 *)b->done, *row;
+	const my_u16 *pcs = (const my_u16 *)b->pc;
+	my_u8 high = (my_u8){ 0 } + 0xFF, low = high;
+	uint8_t code[3];
+	unsigned int c, i, j, lead, size, active, group;
+	int shared;
+	uint16_t pc;
+
+	active = b->lanes - my_count(b, b->done);
+	if (!active) {
+		return 0;
+	}
+
+	/* The high byte first, then the low one of those with it. */
+	MY_CHUNKS(b, c) {
+		high = my_lesser(high, (my_u8)(done[c] == 0), my_high(&pcs[c]));
+	}
+	pc = my_least(high) << 8;
+	MY_CHUNKS(b, c) {
+		low = my_lesser(low, (my_u8)(done[c] == 0)
+			& (my_u8)(my_high(&pcs[c]) == (uint8_t)(pc >> 8)), my_low(&pcs[c]));
+	}
+	pc |= my_least(low);
+	if (!b->horizon) {
+		/* Reached in a step that retired no lanes. */
+		my_batch_horizon(b, max_instructions);
+	}
+	b->horizon--;
+
+	MY_CHUNKS(b, c) {
+		m[c] = my_equal16(&pcs[c], pc) & (my_u8)(done[c] == 0);
+	}
+
+	for (lead = 0; !b->mask[lead]; lead++)
+		;
+	for (i = 0; i < sizeof(code); i++) {
+		code[i] = my6502_batch_peek(b, lead, pc + i);
+	}
+	size = my6502_insn_size(code[0]);
+	shared = b->rom_pages[pc >> 8]
+		&& b->rom_pages[(uint16_t)(pc + size - 1) >> 8];
+
+	if (active == 1) {
+		/* The last one runs to the end on its own. */
+		my_batch_scalar(b, lead, UINT64_MAX, max_instructions);
+		return 1;
+	}
+
+	/* Instances with other code at the same PC go alone. */
+	if (!shared) {
+		MY_CHUNKS(b, c) diff[c] = (my_u8){ 0 };
+		for (j = 0; j < size; j++) {
+			if (b->rom_pages[(uint16_t)(pc + j) >> 8]) {
+				continue;
+			}
+			row = (const my_u8 *)(b->mem
+				+ (size_t)(uint16_t)(pc + j) * b->lanes);
+			MY_CHUNKS(b, c) diff[c] |= m[c] & (row[c] ^ code[j]);
+		}
+		MY_CHUNKS(b, c) {
+			if (!my_any(&diff[c])) {
+				continue;
+			}
+			for (i = c * MY6502_BATCH_CHUNK;
+				i < (c + 1) * MY6502_BATCH_CHUNK; i++) {
+				if (b->value[i]) {
+					b->mask[i] = 0;
+					my_batch_scalar(b, i, 1, max_instructions);
+				}
+			}
+		}
+	}
+	group = my_count(b, b->mask);
+
+	if (group == 1) {
+		/* Lanes don't pay off for one. */
+		for (i = lead; !b->mask[i]; i++)
+			;
+		my_batch_scalar(b, i, 1, max_instructions);
+		return 1;
+	}
+
+	if (!my_batch_lanes(b, pc, code)) {
+		MY_MASKED(b, i) my_batch_scalar(b, i, 1, max_instructions);
+		return 1;
+	}
+
+	my_batch_retire(b, pc, max_instructions);
+	return 1;
+}
+
+void my6502_batch_run(struct my6502_batch *b, uint64_t max_instructions)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->count; i++) {
+		if (b->done[i] && b->stop[i] == MY6502_STOP_TRAP) {
+			continue;
+		}
+		b->done[i] = b->instructions[i] >= max_instructions;
+		b->stop[i] = MY6502_STOP_BUDGET;
+	}
+
+	my_batch_horizon(b, max_instructions);
+	while (my_batch_step(b, max_instructions))
+		;
+}
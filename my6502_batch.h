@@ -0,0 +1,93 @@
+#ifndef MY6502_BATCH_H
+#define MY6502_BATCH_H
+
+#include <stdint.h>
+
+#include "my6502.h"
+
+/* Lanes are processed this many at a time, a SIMD register of bytes
+ * wide on most targets. */
+#define MY6502_BATCH_CHUNK 16
+
+/* Many instances of the same program, each with its own 64 KiB of RAM
+ * and a ROM shared by all, and no MMIO, interrupts nor breakpoints.
+ * The registers are kept in an array each, and the instances at the
+ * same instruction execute it together, a lane per instance. The
+ * instructions that aren't stepped in lanes, and instances which code
+ * in RAM differs at the same PC, run on my6502 one at a time. */
+struct my6502_batch {
+	unsigned int count;
+	/* count rounded up to MY6502_BATCH_CHUNK, the extra lanes are
+	 * done from the start. The arrays are aligned for the chunks. */
+	unsigned int lanes;
+
+	uint16_t *pc;
+	uint8_t *ac;
+	uint8_t *x;
+	uint8_t *y;
+	uint8_t *sp;
+	uint8_t *sr;
+	uint64_t *cycles;
+	uint64_t *instructions;
+
+	/* Set once an instance stops, for the reason in stop. */
+	uint8_t *done;
+	uint8_t *stop;
+	/* Steps left before an instance may run out of its budget. */
+	uint64_t horizon;
+
+	/* Instances at the instruction being executed, and its effective
+	 * address, operand and page crossing in each. */
+	uint8_t *mask;
+	uint16_t *addr;
+	uint8_t *value;
+	uint8_t *cross;
+
+	/* 64 KiB per instance, interleaved: the byte at an address is at
+	 * mem[address * lanes + i] for each instance i, so the instances
+	 * accessing the same address touch a single row. See
+	 * my6502_batch_peek(). */
+	uint8_t *mem;
+	/* The RAM of an instance running on my6502 for long. */
+	uint8_t *copy;
+
+	/* See my6502_batch_rom(). */
+	const uint8_t *rom_pages[0x100];
+
+	/* Runs the instructions that aren't stepped in lanes, for the
+	 * instance in lane. */
+	struct my6502 cpu;
+	unsigned int lane;
+};
+
+/* Allocate count instances with zeroed memory and reset them to PC 0.
+ * Return -1 if out of memory. */
+int my6502_batch_init(struct my6502_batch *b, unsigned int count);
+
+void my6502_batch_free(struct my6502_batch *b);
+
+/* Reset an instance as my6502_reset() does, and its counters. */
+void my6502_batch_reset(struct my6502_batch *b, unsigned int i, uint16_t pc);
+
+/* Access the memory of an instance, ROM included. */
+uint8_t my6502_batch_peek(const struct my6502_batch *b, unsigned int i,
+                          uint16_t address);
+void my6502_batch_poke(struct my6502_batch *b, unsigned int i,
+                       uint16_t address, uint8_t value);
+
+/* Copy data into the memory of every instance. */
+void my6502_batch_load(struct my6502_batch *b, uint16_t address,
+                       uint32_t size, const uint8_t *data);
+
+/* Share read-only memory among the instances, which ignore writes to
+ * it. Code in it is known to be the same for all, so it's the fastest
+ * to run. Address and size are multiples of 256. */
+void my6502_batch_rom(struct my6502_batch *b, uint16_t address,
+                      uint32_t size, const uint8_t *rom);
+
+/* Run every instance until it traps or its instruction counter reaches
+ * max_instructions, with stop set to MY6502_STOP_TRAP or
+ * MY6502_STOP_BUDGET. Instances stopped by the budget earlier go on. */
+void my6502_batch_run(struct my6502_batch *b, uint64_t max_instructions);
+
+#endif
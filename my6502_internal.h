@@ -0,0 +1,41 @@
+#ifndef MY6502_INTERNAL_H
+#define MY6502_INTERNAL_H
+
+/* Definitions shared by my6502.c and my6502_batch.c, not part of the
+ * API. */
+
+/* NV-BDIZC */
+#define SR_FLAG_NEGATIVE  (1 << 7)
+#define SR_FLAG_OVERFLOW  (1 << 6)
+
+/* At power-up, the 'unused' bit in the Status Register is hardwired
+ * to logic '1' by the internal circuitry of the CPU. It can never be
+ * anything other than '1', since it is not controlled by any internal
+ * flag or register but is determined by a physical connection to
+ * a 'high' signal line. */
+#define SR_FLAG_UNUSED    (1 << 5)
+
+#define SR_FLAG_BREAK     (1 << 4)
+#define SR_FLAG_DECIMAL   (1 << 3)
+#define SR_FLAG_INTERRUPT (1 << 2)
+#define SR_FLAG_ZERO      (1 << 1)
+#define SR_FLAG_CARRY     (1 << 0)
+
+/* Addressing modes, as named in my6502_opcodes.h. */
+enum my_addr {
+	IMPLIED,
+	IMMEDIATE,
+	ABSOLUTE,
+	ABSOLUTE_X,
+	ABSOLUTE_Y,
+	ACCUMULATOR,
+	RELATIVE,
+	INDIRECT,
+	INDIRECT_X,
+	INDIRECT_Y,
+	ZEROPAGE,
+	ZEROPAGE_X,
+	ZEROPAGE_Y,
+};
+
+#endif
@@ -0,0 +1,162 @@
+/* Opcode table, included with OP(code, name, mode, cycles, flags, kind)
+ * defined. It gives the mnemonic and my_<name>(), the handler; the
+ * addressing mode; the cycles, | P if indexing across a page takes one
+ * more; the status flags it may change; and how the handler takes the
+ * operand:
+ *
+ * - IMPLIED: none, my_<name>(cpu)
+ * - READ: its value, my_<name>(cpu, value)
+ * - ADDRESS: its effective address, my_<name>(cpu, address)
+ * - MODIFY: its value, returning the new one, value = my_<name>(cpu, value)
+ */
+OP(0x00, brk, IMPLIED, 7, I, IMPLIED)
+OP(0x01, ora, INDIRECT_X, 6, NZ, READ)
+OP(0x05, ora, ZEROPAGE, 3, NZ, READ)
+OP(0x06, asl, ZEROPAGE, 5, NZC, MODIFY)
+OP(0x08, php, IMPLIED, 3, NONE, IMPLIED)
+OP(0x09, ora, IMMEDIATE, 2, NZ, READ)
+OP(0x0A, asl, ACCUMULATOR, 2, NZC, MODIFY)
+OP(0x0D, ora, ABSOLUTE, 4, NZ, READ)
+OP(0x0E, asl, ABSOLUTE, 6, NZC, MODIFY)
+OP(0x10, bpl, RELATIVE, 2, NONE, ADDRESS)
+OP(0x11, ora, INDIRECT_Y, 5 | P, NZ, READ)
+OP(0x15, ora, ZEROPAGE_X, 4, NZ, READ)
+OP(0x16, asl, ZEROPAGE_X, 6, NZC, MODIFY)
+OP(0x18, clc, IMPLIED, 2, C, IMPLIED)
+OP(0x19, ora, ABSOLUTE_Y, 4 | P, NZ, READ)
+OP(0x1D, ora, ABSOLUTE_X, 4 | P, NZ, READ)
+OP(0x1E, asl, ABSOLUTE_X, 7, NZC, MODIFY)
+OP(0x20, jsr, ABSOLUTE, 6, NONE, ADDRESS)
+OP(0x21, and, INDIRECT_X, 6, NZ, READ)
+OP(0x24, bit, ZEROPAGE, 3, NVZ, READ)
+OP(0x25, and, ZEROPAGE, 3, NZ, READ)
+OP(0x26, rol, ZEROPAGE, 5, NZC, MODIFY)
+OP(0x28, plp, IMPLIED, 4, ALL, IMPLIED)
+OP(0x29, and, IMMEDIATE, 2, NZ, READ)
+OP(0x2A, rol, ACCUMULATOR, 2, NZC, MODIFY)
+OP(0x2C, bit, ABSOLUTE, 4, NVZ, READ)
+OP(0x2D, and, ABSOLUTE, 4, NZ, READ)
+OP(0x2E, rol, ABSOLUTE, 6, NZC, MODIFY)
+OP(0x30, bmi, RELATIVE, 2, NONE, ADDRESS)
+OP(0x31, and, INDIRECT_Y, 5 | P, NZ, READ)
+OP(0x35, and, ZEROPAGE_X, 4, NZ, READ)
+OP(0x36, rol, ZEROPAGE_X, 6, NZC, MODIFY)
+OP(0x38, sec, IMPLIED, 2, C, IMPLIED)
+OP(0x39, and, ABSOLUTE_Y, 4 | P, NZ, READ)
+OP(0x3D, and, ABSOLUTE_X, 4 | P, NZ, READ)
+OP(0x3E, rol, ABSOLUTE_X, 7, NZC, MODIFY)
+OP(0x40, rti, IMPLIED, 6, ALL, IMPLIED)
+OP(0x41, eor, INDIRECT_X, 6, NZ, READ)
+OP(0x45, eor, ZEROPAGE, 3, NZ, READ)
+OP(0x46, lsr, ZEROPAGE, 5, NZC, MODIFY)
+OP(0x48, pha, IMPLIED, 3, NONE, IMPLIED)
+OP(0x49, eor, IMMEDIATE, 2, NZ, READ)
+OP(0x4A, lsr, ACCUMULATOR, 2, NZC, MODIFY)
+OP(0x4C, jmp, ABSOLUTE, 3, NONE, ADDRESS)
+OP(0x4D, eor, ABSOLUTE, 4, NZ, READ)
+OP(0x4E, lsr, ABSOLUTE, 6, NZC, MODIFY)
+OP(0x50, bvc, RELATIVE, 2, NONE, ADDRESS)
+OP(0x51, eor, INDIRECT_Y, 5 | P, NZ, READ)
+OP(0x55, eor, ZEROPAGE_X, 4, NZ, READ)
+OP(0x56, lsr, ZEROPAGE_X, 6, NZC, MODIFY)
+OP(0x58, cli, IMPLIED, 2, I, IMPLIED)
+OP(0x59, eor, ABSOLUTE_Y, 4 | P, NZ, READ)
+OP(0x5D, eor, ABSOLUTE_X, 4 | P, NZ, READ)
+OP(0x5E, lsr, ABSOLUTE_X, 7, NZC, MODIFY)
+OP(0x60, rts, IMPLIED, 6, NONE, IMPLIED)
+OP(0x61, adc, INDIRECT_X, 6, NVZC, READ)
+OP(0x65, adc, ZEROPAGE, 3, NVZC, READ)
+OP(0x66, ror, ZEROPAGE, 5, NZC, MODIFY)
+OP(0x68, pla, IMPLIED, 4, NZ, IMPLIED)
+OP(0x69, adc, IMMEDIATE, 2, NVZC, READ)
+OP(0x6A, ror, ACCUMULATOR, 2, NZC, MODIFY)
+OP(0x6C, jmp, INDIRECT, 5, NONE, ADDRESS)
+OP(0x6D, adc, ABSOLUTE, 4, NVZC, READ)
+OP(0x6E, ror, ABSOLUTE, 6, NZC, MODIFY)
+OP(0x70, bvs, RELATIVE, 2, NONE, ADDRESS)
+OP(0x71, adc, INDIRECT_Y, 5 | P, NVZC, READ)
+OP(0x75, adc, ZEROPAGE_X, 4, NVZC, READ)
+OP(0x76, ror, ZEROPAGE_X, 6, NZC, MODIFY)
+OP(0x78, sei, IMPLIED, 2, I, IMPLIED)
+OP(0x79, adc, ABSOLUTE_Y, 4 | P, NVZC, READ)
+OP(0x7D, adc, ABSOLUTE_X, 4 | P, NVZC, READ)
+OP(0x7E, ror, ABSOLUTE_X, 7, NZC, MODIFY)
+OP(0x81, sta, INDIRECT_X, 6, NONE, ADDRESS)
+OP(0x84, sty, ZEROPAGE, 3, NONE, ADDRESS)
+OP(0x85, sta, ZEROPAGE, 3, NONE, ADDRESS)
+OP(0x86, stx, ZEROPAGE, 3, NONE, ADDRESS)
+OP(0x88, dey, IMPLIED, 2, NZ, IMPLIED)
+OP(0x8A, txa, IMPLIED, 2, NZ, IMPLIED)
+OP(0x8C, sty, ABSOLUTE, 4, NONE, ADDRESS)
+OP(0x8D, sta, ABSOLUTE, 4, NONE, ADDRESS)
+OP(0x8E, stx, ABSOLUTE, 4, NONE, ADDRESS)
+OP(0x90, bcc, RELATIVE, 2, NONE, ADDRESS)
+OP(0x91, sta, INDIRECT_Y, 6, NONE, ADDRESS)
+OP(0x94, sty, ZEROPAGE_X, 4, NONE, ADDRESS)
+OP(0x95, sta, ZEROPAGE_X, 4, NONE, ADDRESS)
+OP(0x96, stx, ZEROPAGE_Y, 4, NONE, ADDRESS)
+OP(0x98, tya, IMPLIED, 2, NZ, IMPLIED)
+OP(0x99, sta, ABSOLUTE_Y, 5, NONE, ADDRESS)
+OP(0x9A, txs, IMPLIED, 2, NONE, IMPLIED)
+OP(0x9D, sta, ABSOLUTE_X, 5, NONE, ADDRESS)
+OP(0xA0, ldy, IMMEDIATE, 2, NZ, READ)
+OP(0xA1, lda, INDIRECT_X, 6, NZ, READ)
+OP(0xA2, ldx, IMMEDIATE, 2, NZ, READ)
+OP(0xA4, ldy, ZEROPAGE, 3, NZ, READ)
+OP(0xA5, lda, ZEROPAGE, 3, NZ, READ)
+OP(0xA6, ldx, ZEROPAGE, 3, NZ, READ)
+OP(0xA8, tay, IMPLIED, 2, NZ, IMPLIED)
+OP(0xA9, lda, IMMEDIATE, 2, NZ, READ)
+OP(0xAA, tax, IMPLIED, 2, NZ, IMPLIED)
+OP(0xAC, ldy, ABSOLUTE, 4, NZ, READ)
+OP(0xAD, lda, ABSOLUTE, 4, NZ, READ)
+OP(0xAE, ldx, ABSOLUTE, 4, NZ, READ)
+OP(0xB0, bcs, RELATIVE, 2, NONE, ADDRESS)
+OP(0xB1, lda, INDIRECT_Y, 5 | P, NZ, READ)
+OP(0xB4, ldy, ZEROPAGE_X, 4, NZ, READ)
+OP(0xB5, lda, ZEROPAGE_X, 4, NZ, READ)
+OP(0xB6, ldx, ZEROPAGE_Y, 4, NZ, READ)
+OP(0xB8, clv, IMPLIED, 2, V, IMPLIED)
+OP(0xB9, lda, ABSOLUTE_Y, 4 | P, NZ, READ)
+OP(0xBA, tsx, IMPLIED, 2, NZ, IMPLIED)
+OP(0xBC, ldy, ABSOLUTE_X, 4 | P, NZ, READ)
+OP(0xBD, lda, ABSOLUTE_X, 4 | P, NZ, READ)
+OP(0xBE, ldx, ABSOLUTE_Y, 4 | P, NZ, READ)
+OP(0xC0, cpy, IMMEDIATE, 2, NZC, READ)
+OP(0xC1, cmp, INDIRECT_X, 6, NZC, READ)
+OP(0xC4, cpy, ZEROPAGE, 3, NZC, READ)
+OP(0xC5, cmp, ZEROPAGE, 3, NZC, READ)
+OP(0xC6, dec, ZEROPAGE, 5, NZ, MODIFY)
+OP(0xC8, iny, IMPLIED, 2, NZ, IMPLIED)
+OP(0xC9, cmp, IMMEDIATE, 2, NZC, READ)
+OP(0xCA, dex, IMPLIED, 2, NZ, IMPLIED)
+OP(0xCC, cpy, ABSOLUTE, 4, NZC, READ)
+OP(0xCD, cmp, ABSOLUTE, 4, NZC, READ)
+OP(0xCE, dec, ABSOLUTE, 6, NZ, MODIFY)
+OP(0xD0, bne, RELATIVE, 2, NONE, ADDRESS)
+OP(0xD1, cmp, INDIRECT_Y, 5 | P, NZC, READ)
+OP(0xD5, cmp, ZEROPAGE_X, 4, NZC, READ)
+OP(0xD6, dec, ZEROPAGE_X, 6, NZ, MODIFY)
+OP(0xD8, cld, IMPLIED, 2, D, IMPLIED)
+OP(0xD9, cmp, ABSOLUTE_Y, 4 | P, NZC, READ)
+OP(0xDD, cmp, ABSOLUTE_X, 4 | P, NZC, READ)
+OP(0xDE, dec, ABSOLUTE_X, 7, NZ, MODIFY)
+OP(0xE0, cpx, IMMEDIATE, 2, NZC, READ)
+OP(0xE1, sbc, INDIRECT_X, 6, NVZC, READ)
+OP(0xE6, inc, ZEROPAGE, 5, NZ, MODIFY)
+OP(0xE4, cpx, ZEROPAGE, 3, NZC, READ)
+OP(0xE5, sbc, ZEROPAGE, 3, NVZC, READ)
+OP(0xE8, inx, IMPLIED, 2, NZ, IMPLIED)
+OP(0xE9, sbc, IMMEDIATE, 2, NVZC, READ)
+OP(0xEA, nop, IMPLIED, 2, NONE, IMPLIED)
+OP(0xEC, cpx, ABSOLUTE, 4, NZC, READ)
+OP(0xED, sbc, ABSOLUTE, 4, NVZC, READ)
+OP(0xEE, inc, ABSOLUTE, 6, NZ, MODIFY)
+OP(0xF0, beq, RELATIVE, 2, NONE, ADDRESS)
+OP(0xF1, sbc, INDIRECT_Y, 5 | P, NVZC, READ)
+OP(0xF5, sbc, ZEROPAGE_X, 4, NVZC, READ)
+OP(0xF6, inc, ZEROPAGE_X, 6, NZ, MODIFY)
+OP(0xF8, sed, IMPLIED, 2, D, IMPLIED)
+OP(0xF9, sbc, ABSOLUTE_Y, 4 | P, NVZC, READ)
+OP(0xFD, sbc, ABSOLUTE_X, 4 | P, NVZC, READ)
+OP(0xFE, inc, ABSOLUTE_X, 7, NZ, MODIFY)
@@ -0,0 +1,373 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "my6502.h"
+
+#ifndef MY6502_PROFILE
+#error "build with -DMY6502_PROFILE for the shadow call stack"
+#endif
+
+/* Profile a ROM running on my6502 alone. Samples attribute to the
+ * nearest label at or below the PC, and the shadow call stack kept by
+ * JSR and RTS gives the stacks. */
+
+static struct my6502 cpu;
+static uint8_t mem[0x10000];
+
+/* Labels from an ld65 -Ln or VICE symbol file, sorted by address. */
+struct label {
+	uint16_t address;
+	char *name;
+};
+
+static struct label *labels;
+static size_t label_count;
+
+/* Distinct stacks seen, with their sample counts. */
+#define MAX_DEPTH 16
+
+struct stack {
+	uint16_t frames[MAX_DEPTH + 1];
+	unsigned int depth;
+	uint64_t samples;
+};
+
+#define STACKS_SZ 4096 /* Power of two. */
+
+static struct stack stacks[STACKS_SZ];
+static size_t stack_count;
+
+static uint64_t flat[0x10000];
+
+static void load_memory(const char *file_name)
+{
+	struct stat s;
+	int fd, rc;
+	void *p;
+
+	fd = open(file_name, O_RDONLY);
+	assert(fd >= 0);
+
+	rc = fstat(fd, &s);
+	assert(rc == 0);
+	assert(s.st_size <= sizeof(mem));
+
+	p = mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	assert(p != MAP_FAILED);
+
+	memcpy(mem, p, s.st_size);
+
+	munmap(p, s.st_size);
+	close(fd);
+}
+
+static int cmp_label(const void *a, const void *b)
+{
+	const struct label *la = a, *lb = b;
+
+	return (int)la->address - (int)lb->address;
+}
+
+/* Both formats have lines such as "al 00C000 .reset" and VICE may
+ * prefix the address with "C:". Local labels starting with '@' are
+ * skipped, they would split functions into loops. */
+static void load_labels(const char *file_name)
+{
+	char line[256], addr[32], name[200];
+	size_t cap = 0;
+	char *p;
+	FILE *f;
+
+	f = fopen(file_name, "r");
+	if (!f) {
+		printf("can't open %s\n", file_name);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "al %31s %199s", addr, name) != 2) {
+			continue;
+		}
+
+		p = strchr(addr, ':');
+		p = p ? p + 1 : addr;
+		if (name[0] == '@' || (name[0] == '.' && name[1] == '@')) {
+			continue;
+		}
+
+		if (label_count == cap) {
+			cap = cap ? cap * 2 : 256;
+			labels = realloc(labels, cap * sizeof(*labels));
+			assert(labels);
+		}
+		labels[label_count].address = strtoul(p, NULL, 16);
+		labels[label_count].name = strdup(name[0] == '.' ? name + 1 : name);
+		label_count++;
+	}
+	fclose(f);
+
+	qsort(labels, label_count, sizeof(*labels), cmp_label);
+}
+
+static const struct label *find_label(uint16_t address)
+{
+	size_t lo = 0, hi = label_count;
+
+	/* Last label at or below address. */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (labels[mid].address <= address) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo ? &labels[lo - 1] : NULL;
+}
+
+static void print_symbol(FILE *f, uint16_t address)
+{
+	const struct label *l = find_label(address);
+
+	if (l) {
+		fprintf(f, "%s", l->name);
+	} else {
+		fprintf(f, "$%04X", address);
+	}
+}
+
+/* Functions are told apart by their labels, or by their addresses
+ * without a symbol file. */
+static uint16_t function_of(uint16_t address)
+{
+	const struct label *l = find_label(address);
+
+	return l ? l->address : address;
+}
+
+static void sample(uint16_t start)
+{
+	struct stack s;
+	unsigned int depth = cpu.call_depth;
+	unsigned int i, first = 0;
+	uint32_t h = 0;
+	size_t slot;
+
+	flat[cpu.pc]++;
+
+	/* The outermost frames go if it's too deep. */
+	if (depth > MY6502_CALL_DEPTH) {
+		depth = MY6502_CALL_DEPTH;
+	}
+	if (depth > MAX_DEPTH - 1) {
+		first = depth - (MAX_DEPTH - 1);
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.frames[s.depth++] = function_of(start);
+	for (i = first; i < depth; i++) {
+		s.frames[s.depth++] = function_of(cpu.calls[i].entry);
+	}
+	/* Inside a labelled part of the function, or code reached with
+	 * JMP. */
+	if (function_of(cpu.pc) != s.frames[s.depth - 1]) {
+		s.frames[s.depth++] = function_of(cpu.pc);
+	}
+
+	for (i = 0; i < s.depth; i++) {
+		h = (h ^ s.frames[i]) * 16777619u;
+	}
+
+	for (slot = h & (STACKS_SZ - 1); stacks[slot].depth;
+		slot = (slot + 1) & (STACKS_SZ - 1)) {
+		if (stacks[slot].depth == s.depth
+			&& !memcmp(stacks[slot].frames, s.frames,
+				s.depth * sizeof(s.frames[0]))) {
+			stacks[slot].samples++;
+			return;
+		}
+	}
+
+	/* Keep the table at most half full, drop new stacks past it. */
+	if (stack_count < STACKS_SZ / 2) {
+		s.samples = 1;
+		stacks[slot] = s;
+		stack_count++;
+	}
+}
+
+static void write_collapsed(const char *file_name)
+{
+	unsigned int i, j;
+	FILE *f;
+
+	f = fopen(file_name, "w");
+	if (!f) {
+		printf("can't create %s\n", file_name);
+		exit(1);
+	}
+
+	for (i = 0; i < STACKS_SZ; i++) {
+		if (!stacks[i].depth) {
+			continue;
+		}
+		for (j = 0; j < stacks[i].depth; j++) {
+			if (j) {
+				fputc(';', f);
+			}
+			print_symbol(f, stacks[i].frames[j]);
+		}
+		fprintf(f, " %llu\n", (unsigned long long)stacks[i].samples);
+	}
+
+	fclose(f);
+}
+
+/* Samples per function, hottest first. */
+static void print_flat(uint64_t total, unsigned int top)
+{
+	static uint64_t functions[0x10000];
+	unsigned int i, j, best;
+
+	for (i = 0; i < 0x10000; i++) {
+		functions[function_of(i)] += flat[i];
+	}
+
+	printf("samples              %%      function\n");
+	for (j = 0; j < top; j++) {
+		best = 0;
+		for (i = 1; i < 0x10000; i++) {
+			if (functions[i] > functions[best]) {
+				best = i;
+			}
+		}
+		if (!functions[best]) {
+			break;
+		}
+		printf("%-20llu %6.2f ", (unsigned long long)functions[best],
+			100.0 * functions[best] / total);
+		print_symbol(stdout, best);
+		printf("\n");
+		functions[best] = 0;
+	}
+}
+
+static void usage(void)
+{
+	printf("Usage: %s [-n <cycles> | -a] [-l <labels>] [-o <file>]"
+		" [-p <pc>] [-m <insns>] <rom.bin>\n"
+		"  -n  sample every so many cycles, 10007 by default\n"
+		"  -a  count every instruction instead\n"
+		"  -l  ld65 -Ln or VICE symbol file\n"
+		"  -o  write collapsed stacks for flamegraph.pl\n"
+		"  -p  start address, 0x400 by default\n"
+		"  -m  stop after so many instructions\n", getprogname());
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t interval = 10007;
+	uint64_t max_instructions = UINT64_MAX;
+	uint64_t next, total = 0, n;
+	const char *collapsed_name = NULL;
+	enum my6502_stop stop = MY6502_STOP_BUDGET;
+	uint16_t start = 0x400;
+	int every = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:al:o:p:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			interval = strtoull(optarg, NULL, 0);
+			if (!interval) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'a':
+			every = 1;
+			break;
+		case 'l':
+			load_labels(optarg);
+			break;
+		case 'o':
+			collapsed_name = optarg;
+			break;
+		case 'p':
+			start = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_instructions = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return 1;
+	}
+
+	load_memory(argv[optind]);
+	my6502_init(&cpu, NULL, NULL);
+	my6502_map(&cpu, 0, sizeof(mem), mem,
+		MY6502_MAP_READ | MY6502_MAP_WRITE);
+	my6502_reset(&cpu, start);
+	if (my6502_block_cache(&cpu, 1)) {
+		printf("out of memory\n");
+		return 1;
+	}
+
+	next = interval;
+	do {
+		if (every) {
+			n = 1;
+		} else if (cpu.cycles + 7 >= next) {
+			/* No instruction takes more, so it's due. */
+			sample(start);
+			total++;
+			next += interval;
+			continue;
+		} else {
+			/* Can't run past the sample point even if every
+			 * instruction takes 7 cycles. */
+			n = (next - cpu.cycles) / 7;
+		}
+
+		if (n > max_instructions - cpu.instructions) {
+			n = max_instructions - cpu.instructions;
+		}
+		stop = my6502_run(&cpu, n);
+
+		if (every) {
+			sample(start);
+			total++;
+		}
+	} while (stop != MY6502_STOP_TRAP
+		&& cpu.instructions < max_instructions);
+
+	printf("%llu instructions, %llu cycles, %llu samples,"
+		" stopped at pc=0x%04x\n",
+		(unsigned long long)cpu.instructions,
+		(unsigned long long)cpu.cycles, (unsigned long long)total,
+		cpu.pc);
+	if (total) {
+		print_flat(total, 20);
+	}
+	if (collapsed_name) {
+		write_collapsed(collapsed_name);
+	}
+
+	return 0;
+}
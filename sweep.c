@@ -0,0 +1,254 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "my6502.h"
+
+/* Run a ROM on my6502 to a PC once, e.g. past the init code, freeze it
+ * there and run each input from that point. The frozen memory is
+ * mapped copy-on-write, so a run only copies back the pages written by
+ * the runs before it rather than the whole memory. */
+
+static struct my6502 cpu;
+static uint8_t mem[0x10000];
+
+/* Registers when frozen, memory is reverted with my6502_cow_revert(). */
+struct frozen {
+	uint16_t pc;
+	uint8_t ac, x, y, sp, sr;
+	uint64_t cycles;
+	uint64_t instructions;
+};
+
+static struct frozen frozen;
+
+static void load_memory(const char *file_name)
+{
+	struct stat s;
+	int fd, rc;
+	void *p;
+
+	fd = open(file_name, O_RDONLY);
+	assert(fd >= 0);
+
+	rc = fstat(fd, &s);
+	assert(rc == 0);
+	assert(s.st_size <= sizeof(mem));
+
+	p = mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	assert(p != MAP_FAILED);
+
+	memcpy(mem, p, s.st_size);
+
+	munmap(p, s.st_size);
+	close(fd);
+}
+
+/* An input is the contents of a file, poked at the same address for
+ * every run. */
+struct input {
+	const char *name;
+	uint8_t *bytes;
+	size_t size;
+};
+
+static void load_input(struct input *in, const char *file_name)
+{
+	struct stat s;
+	FILE *f;
+
+	in->name = file_name;
+	f = fopen(file_name, "rb");
+	if (!f || fstat(fileno(f), &s)) {
+		perror(file_name);
+		exit(1);
+	}
+	in->size = s.st_size;
+	in->bytes = malloc(in->size + 1);
+	assert(in->bytes);
+	if (fread(in->bytes, 1, in->size, f) != in->size) {
+		printf("%s: short read\n", file_name);
+		exit(1);
+	}
+	fclose(f);
+}
+
+static void freeze(void)
+{
+	frozen = (struct frozen){
+		.pc = cpu.pc, .ac = cpu.ac, .x = cpu.x, .y = cpu.y,
+		.sp = cpu.sp, .sr = my6502_get_sr(&cpu),
+		.cycles = cpu.cycles, .instructions = cpu.instructions,
+	};
+
+	/* Nothing writes to mem from now on. */
+	my6502_map(&cpu, 0, sizeof(mem), mem, MY6502_MAP_COW);
+}
+
+static void thaw(void)
+{
+	my6502_cow_revert(&cpu);
+
+	cpu.pc = frozen.pc;
+	cpu.ac = frozen.ac;
+	cpu.x = frozen.x;
+	cpu.y = frozen.y;
+	cpu.sp = frozen.sp;
+	my6502_set_sr(&cpu, frozen.sr);
+	cpu.cycles = frozen.cycles;
+	cpu.instructions = frozen.instructions;
+}
+
+static const char *stop_names[] = {
+	[MY6502_STOP_BUDGET] = "budget",
+	[MY6502_STOP_TRAP] = "trap",
+	[MY6502_STOP_BREAKPOINT] = "end",
+	[MY6502_STOP_EVENT] = "event",
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void)
+{
+	printf("Usage: %s -f <pc> [-p <pc>] [-e <pc>] [-m <insns>]"
+		" [-a <address>] [-n <rounds>]\n"
+		"       <rom.bin> [input...]\n"
+		"  -f  freeze when reaching this address\n"
+		"  -p  start address, 0x400 by default\n"
+		"  -e  end a run when reaching this address\n"
+		"  -m  end a run after so many instructions, 100000000 by"
+		" default\n"
+		"  -a  poke every input at this address, 0x200 by default\n"
+		"  -n  run the inputs so many times, reporting the first\n"
+		"With no inputs, runs once from the frozen state.\n",
+		getprogname());
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t max_instructions = 100000000;
+	uint64_t rounds = 1, round, runs = 0, instructions = 0;
+	uint16_t start = 0x400, at = 0x200, freeze_pc = 0, end_pc = 0;
+	struct input *inputs, none = { .name = "-" };
+	enum my6502_stop stop;
+	unsigned int count, i;
+	int opt, has_freeze = 0, has_end = 0;
+	double t, restore = 0;
+	size_t j;
+
+	while ((opt = getopt(argc, argv, "f:p:e:m:a:n:")) != -1) {
+		switch (opt) {
+		case 'f':
+			freeze_pc = strtoul(optarg, NULL, 0);
+			has_freeze = 1;
+			break;
+		case 'p':
+			start = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			end_pc = strtoul(optarg, NULL, 0);
+			has_end = 1;
+			break;
+		case 'm':
+			max_instructions = strtoull(optarg, NULL, 0);
+			break;
+		case 'a':
+			at = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			rounds = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 1 || !has_freeze || !rounds) {
+		usage();
+		return 1;
+	}
+
+	load_memory(argv[optind++]);
+	count = argc - optind;
+	inputs = count ? calloc(count, sizeof(*inputs)) : &none;
+	assert(inputs);
+	for (i = 0; i < count; i++) {
+		load_input(&inputs[i], argv[optind + i]);
+	}
+	if (!count) {
+		count = 1;
+	}
+
+	my6502_init(&cpu, NULL, NULL);
+	my6502_map(&cpu, 0, sizeof(mem), mem,
+		MY6502_MAP_READ | MY6502_MAP_WRITE);
+	my6502_reset(&cpu, start);
+	if (my6502_block_cache(&cpu, 1)) {
+		printf("out of memory\n");
+		return 1;
+	}
+
+	my6502_set_breakpoint(&cpu, freeze_pc, 1);
+	stop = my6502_run(&cpu, UINT64_MAX);
+	my6502_set_breakpoint(&cpu, freeze_pc, 0);
+	if (stop != MY6502_STOP_BREAKPOINT) {
+		printf("trapped at pc=0x%04x before reaching 0x%04x\n",
+			cpu.pc, freeze_pc);
+		return 1;
+	}
+	printf("frozen at pc=0x%04x after %llu instructions\n", cpu.pc,
+		(unsigned long long)cpu.instructions);
+	freeze();
+
+	if (has_end) {
+		my6502_set_breakpoint(&cpu, end_pc, 1);
+	}
+
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < count; i++) {
+			t = now();
+			thaw();
+			for (j = 0; j < inputs[i].size; j++) {
+				my6502_poke(&cpu, at + j, inputs[i].bytes[j]);
+			}
+			restore += now() - t;
+
+			stop = my6502_run(&cpu, max_instructions);
+			instructions += cpu.instructions - frozen.instructions;
+			runs++;
+
+			if (round) {
+				continue;
+			}
+			printf("%s: %s at pc=0x%04x a=%02x x=%02x y=%02x"
+				" sp=%02x sr=%02x, %llu instructions, %llu"
+				" cycles, %u pages copied\n", inputs[i].name,
+				stop_names[stop], cpu.pc, cpu.ac, cpu.x, cpu.y,
+				cpu.sp, my6502_get_sr(&cpu),
+				(unsigned long long)(cpu.instructions
+					- frozen.instructions),
+				(unsigned long long)(cpu.cycles - frozen.cycles),
+				cpu.cow_copies);
+		}
+	}
+
+	printf("%llu runs, %llu instructions, %.0f ns per restore\n",
+		(unsigned long long)runs, (unsigned long long)instructions,
+		restore * 1e9 / runs);
+
+	return 0;
+}
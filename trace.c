@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+/* Records are handed over to the writer a chunk at a time, so the
+ * lock is taken once per TRACE_CHUNK_SZ instructions. */
+#define TRACE_CHUNK_SZ 4096
+#define TRACE_CHUNKS   16
+
+struct trace_chunk {
+	unsigned int len;
+	struct trace_record records[TRACE_CHUNK_SZ];
+};
+
+struct trace {
+	FILE *f;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* Chunks queued by trace_add() and written by the thread so far,
+	 * the difference is at most TRACE_CHUNKS. */
+	unsigned int head;
+	unsigned int tail;
+	int done;
+	int error;
+
+	/* Being filled, owned by the producer. */
+	struct trace_chunk *chunk;
+
+	struct trace_chunk chunks[TRACE_CHUNKS];
+};
+
+static void *trace_writer(void *arg)
+{
+	struct trace *t = arg;
+	struct trace_chunk *chunk;
+
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		while (t->tail == t->head && !t->done) {
+			pthread_cond_wait(&t->cond, &t->lock);
+		}
+		if (t->tail == t->head) {
+			break;
+		}
+		chunk = &t->chunks[t->tail % TRACE_CHUNKS];
+		pthread_mutex_unlock(&t->lock);
+
+		if (fwrite(chunk->records, sizeof(chunk->records[0]),
+			chunk->len, t->f) != chunk->len) {
+			t->error = 1;
+		}
+
+		pthread_mutex_lock(&t->lock);
+		t->tail++;
+		pthread_cond_broadcast(&t->cond);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	return NULL;
+}
+
+struct trace *trace_open(const char *file_name)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+	};
+	struct trace *t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t) {
+		return NULL;
+	}
+
+	t->f = fopen(file_name, "wb");
+	if (!t->f) {
+		free(t);
+		return NULL;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, t->f) != 1) {
+		t->error = 1;
+	}
+
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	t->chunk = &t->chunks[0];
+
+	if (pthread_create(&t->thread, NULL, trace_writer, t)) {
+		fclose(t->f);
+		free(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+/* Queue the chunk being filled and wait for a free one. */
+static void trace_queue(struct trace *t)
+{
+	pthread_mutex_lock(&t->lock);
+	t->head++;
+	pthread_cond_broadcast(&t->cond);
+	while (t->head - t->tail == TRACE_CHUNKS) {
+		pthread_cond_wait(&t->cond, &t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	t->chunk = &t->chunks[t->head % TRACE_CHUNKS];
+	t->chunk->len = 0;
+}
+
+void trace_add(struct trace *t, const struct trace_record *r)
+{
+	t->chunk->records[t->chunk->len++] = *r;
+	if (t->chunk->len == TRACE_CHUNK_SZ) {
+		trace_queue(t);
+	}
+}
+
+int trace_close(struct trace *t)
+{
+	int error;
+
+	if (t->chunk->len) {
+		trace_queue(t);
+	}
+
+	pthread_mutex_lock(&t->lock);
+	t->done = 1;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->thread, NULL);
+
+	error = t->error;
+	if (fclose(t->f)) {
+		error = 1;
+	}
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->cond);
+	free(t);
+
+	return error ? -1 : 0;
+}
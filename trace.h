@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Binary execution trace. The file is a header followed by one fixed
+ * size record per instruction. */
+#define TRACE_MAGIC   0x54353659 /* "Y65T" */
+#define TRACE_VERSION 1
+
+/* Writes kept per record, BRK makes the most. */
+#define TRACE_WRITES 3
+
+struct trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint64_t reserved;
+};
+
+struct trace_record {
+	/* Cycles after the instruction. */
+	uint64_t cycles;
+	/* Address and bytes of the instruction. */
+	uint16_t pc;
+	uint16_t write_address[TRACE_WRITES];
+	uint8_t opcode;
+	uint8_t operand[2];
+	/* Registers after the instruction. */
+	uint8_t ac, x, y, sp, sr;
+	/* Total number of writes, only the first TRACE_WRITES kept. */
+	uint8_t write_count;
+	uint8_t write_value[TRACE_WRITES];
+	/* Bytes of the instruction including the opcode. */
+	uint8_t size;
+	uint8_t reserved;
+	/* PC after the instruction. */
+	uint16_t next_pc;
+};
+
+_Static_assert(sizeof(struct trace_record) == 32, "trace record layout");
+
+struct trace;
+
+/* Start writing a trace to a file on a background thread. Return NULL
+ * if the file can't be created. */
+struct trace *trace_open(const char *file_name);
+
+/* Queue a record. Blocks only if the writer falls behind by the whole
+ * buffer. */
+void trace_add(struct trace *t, const struct trace_record *r);
+
+/* Flush the queued records and close the file. Return -1 if any write
+ * failed. */
+int trace_close(struct trace *t);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "my6502.h"
+#include "trace.h"
+
+/* Print a trace written by 6502.elf -t in the text format of the
+ * verbose lockstep log: the fetches, the writes and the registers of
+ * my6502 for every step, with the disassembly of each instruction if
+ * requested. */
+
+static void usage(void)
+{
+	printf("Usage: %s [-d] <trace.bin>\n"
+		"  -d  disassemble every instruction\n", getprogname());
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_header header;
+	struct trace_record r;
+	unsigned long long step = 1;
+	uint8_t bytes[3];
+	char dis[32];
+	unsigned int i;
+	int opt, disasm = 0;
+	const char *file_name;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "d")) != -1) {
+		switch (opt) {
+		case 'd':
+			disasm = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return 1;
+	}
+	file_name = argv[optind];
+
+	f = fopen(file_name, "rb");
+	if (!f) {
+		printf("can't open %s\n", file_name);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1
+		|| header.magic != TRACE_MAGIC
+		|| header.version != TRACE_VERSION
+		|| header.record_size != sizeof(r)) {
+		printf("%s is not a trace\n", file_name);
+		return 1;
+	}
+
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (disasm) {
+			bytes[0] = r.opcode;
+			bytes[1] = r.operand[0];
+			bytes[2] = r.operand[1];
+			my6502_disasm(r.pc, bytes, dis, sizeof(dis));
+			printf("step %llu: %s\n", step++, dis);
+		} else {
+			printf("step %llu\n", step++);
+		}
+
+		printf("! rd(%04x) -> %02x\n", r.pc, r.opcode);
+		for (i = 1; i < r.size; i++) {
+			printf("! rd(%04x) -> %02x\n", (uint16_t)(r.pc + i),
+				r.operand[i - 1]);
+		}
+
+		for (i = 0; i < r.write_count && i < TRACE_WRITES; i++) {
+			printf("! wr(%04x) = %02x\n", r.write_address[i],
+				r.write_value[i]);
+		}
+		if (r.write_count > TRACE_WRITES) {
+			printf("! %u more writes\n", r.write_count - TRACE_WRITES);
+		}
+
+		printf("! pc=%04x sp=%02x a=%02x x=%02x y=%02x status=%02x"
+			" cycles=%u\n", r.next_pc, r.sp, r.ac, r.x, r.y, r.sr,
+			(uint32_t)r.cycles);
+	}
+
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,557 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "my6502.h"
+
+/* Run the self-checking test ROMs of a manifest on my6502 alone, each
+ * until it traps, and pass those trapping at their success address.
+ * The ROMs are shared by worker threads, each with a CPU of its own
+ * mapping the image copy-on-write. A long ROM may be split into
+ * segments between checkpoints recorded by an earlier run, each
+ * segment verified from its checkpoint against the next one. */
+
+#define MEM_SZ 0x10000
+
+/* A line of the manifest: "<rom.bin> <start> <success> [<insns>]". */
+struct rom {
+	char file_name[PATH_MAX];
+	uint16_t start;
+	uint16_t success;
+	uint64_t max_instructions;
+	const uint8_t *image;
+
+	/* See load_checkpoints(), NULL without them. */
+	const struct checkpoint *checkpoints;
+	unsigned int checkpoint_count;
+
+	/* One more than the first segment failed and why, and the
+	 * instructions run to the end, set by the workers. */
+	atomic_uint failed;
+	char reason[128];
+	uint64_t instructions;
+};
+
+/* Checkpoint file, an array of these. The first one is the state after
+ * reset, the last one the state after the trap. */
+#define CHECKPOINT_MAGIC 0x43353659 /* "Y65C" */
+
+struct checkpoint {
+	uint32_t magic;
+	uint16_t pc;
+	uint8_t ac, x, y, sp, sr;
+	uint8_t stop;
+	uint64_t instructions;
+	uint64_t cycles;
+	uint8_t mem[MEM_SZ];
+};
+
+/* A unit of work, a whole ROM or a segment of one. */
+struct job {
+	struct rom *rom;
+	unsigned int segment;
+};
+
+static struct rom *roms;
+static unsigned int rom_count;
+static struct job *jobs;
+static unsigned int job_count;
+static atomic_uint next_job;
+static pthread_mutex_t fail_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *checkpoint_dir;
+static uint64_t checkpoint_steps;
+static int record;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const void *map_file(const char *file_name, size_t *size)
+{
+	struct stat s;
+	void *p;
+	int fd;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &s) || !s.st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(0, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	*size = s.st_size;
+	return p;
+}
+
+/* The image is zero past the end of the file. */
+static int load_rom(struct rom *rom)
+{
+	uint8_t *image;
+	const void *p;
+	size_t size;
+
+	p = map_file(rom->file_name, &size);
+	if (!p || size > MEM_SZ) {
+		return -1;
+	}
+
+	image = calloc(1, MEM_SZ);
+	assert(image);
+	memcpy(image, p, size);
+	munmap((void *)p, size);
+
+	rom->image = image;
+	return 0;
+}
+
+static int load_manifest(const char *file_name)
+{
+	char line[PATH_MAX + 64];
+	long start, success;
+	long long max;
+	unsigned int n = 0;
+	struct rom *rom;
+	int fields;
+	FILE *f;
+
+	f = fopen(file_name, "r");
+	if (!f) {
+		printf("can't open %s\n", file_name);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		n++;
+		if (line[strspn(line, " \t")] == '#'
+			|| line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+
+		roms = realloc(roms, (rom_count + 1) * sizeof(*roms));
+		assert(roms);
+		rom = &roms[rom_count];
+		memset(rom, 0, sizeof(*rom));
+
+		max = 1000000000;
+		fields = sscanf(line, "%4095s %li %li %lli", rom->file_name,
+			&start, &success, &max);
+		if (fields < 3 || start < 0 || start > 0xFFFF || success < 0
+			|| success > 0xFFFF || max <= 0) {
+			printf("%s:%u: expected <rom.bin> <start> <success>"
+				" [<insns>]\n", file_name, n);
+			fclose(f);
+			return -1;
+		}
+		rom->start = start;
+		rom->success = success;
+		rom->max_instructions = max;
+		rom_count++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void checkpoint_name(const struct rom *rom, char *buf, size_t size)
+{
+	const char *base = strrchr(rom->file_name, '/');
+
+	snprintf(buf, size, "%s/%s.ckpt", checkpoint_dir,
+		base ? base + 1 : rom->file_name);
+}
+
+static int load_checkpoints(struct rom *rom)
+{
+	char file_name[2 * PATH_MAX];
+	const struct checkpoint *c;
+	unsigned int i, count;
+	size_t size;
+
+	checkpoint_name(rom, file_name, sizeof(file_name));
+	c = map_file(file_name, &size);
+	if (!c || size % sizeof(*c)) {
+		return -1;
+	}
+
+	count = size / sizeof(*c);
+	for (i = 0; i < count; i++) {
+		if (c[i].magic != CHECKPOINT_MAGIC) {
+			return -1;
+		}
+	}
+
+	/* The last one is where the run stopped. */
+	if (count < 2) {
+		return -1;
+	}
+
+	rom->checkpoints = c;
+	rom->checkpoint_count = count;
+	return 0;
+}
+
+static void checkpoint_take(struct my6502 *cpu, enum my6502_stop stop,
+                            struct checkpoint *c)
+{
+	unsigned int i;
+
+	c->magic = CHECKPOINT_MAGIC;
+	c->pc = cpu->pc;
+	c->ac = cpu->ac;
+	c->x = cpu->x;
+	c->y = cpu->y;
+	c->sp = cpu->sp;
+	c->sr = my6502_get_sr(cpu);
+	c->stop = stop;
+	c->instructions = cpu->instructions;
+	c->cycles = cpu->cycles;
+	for (i = 0; i < MEM_SZ; i++) {
+		c->mem[i] = my6502_peek(cpu, i);
+	}
+}
+
+static void checkpoint_restore(struct my6502 *cpu, const struct checkpoint *c)
+{
+	my6502_map(cpu, 0, MEM_SZ, (uint8_t *)c->mem, MY6502_MAP_COW);
+	cpu->pc = c->pc;
+	cpu->ac = c->ac;
+	cpu->x = c->x;
+	cpu->y = c->y;
+	cpu->sp = c->sp;
+	my6502_set_sr(cpu, c->sr);
+	cpu->instructions = c->instructions;
+	cpu->cycles = c->cycles;
+}
+
+/* Describe the first difference from a checkpoint, return 0 if none. */
+static int checkpoint_cmp(struct my6502 *cpu, const struct checkpoint *c,
+                          char *buf, size_t size)
+{
+	unsigned int i;
+
+	if (cpu->instructions != c->instructions || cpu->pc != c->pc
+		|| cpu->ac != c->ac || cpu->x != c->x || cpu->y != c->y
+		|| cpu->sp != c->sp || my6502_get_sr(cpu) != c->sr
+		|| cpu->cycles != c->cycles) {
+		snprintf(buf, size, "at %llu instructions pc=%04x a=%02x"
+			" x=%02x y=%02x sp=%02x sr=%02x, expected pc=%04x"
+			" a=%02x x=%02x y=%02x sp=%02x sr=%02x",
+			(unsigned long long)cpu->instructions, cpu->pc,
+			cpu->ac, cpu->x, cpu->y, cpu->sp, my6502_get_sr(cpu),
+			c->pc, c->ac, c->x, c->y, c->sp, c->sr);
+		return 1;
+	}
+
+	for (i = 0; i < MEM_SZ; i++) {
+		if (my6502_peek(cpu, i) != c->mem[i]) {
+			snprintf(buf, size, "at %llu instructions"
+				" mem[%04x]=%02x, expected %02x",
+				(unsigned long long)cpu->instructions, i,
+				my6502_peek(cpu, i), c->mem[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* The failure in the earliest segment of a ROM is kept, whatever
+ * order the segments finish in. */
+static void fail(struct rom *rom, unsigned int segment, const char *reason)
+{
+	unsigned int failed;
+
+	pthread_mutex_lock(&fail_lock);
+	failed = atomic_load(&rom->failed);
+	if (!failed || segment < failed - 1) {
+		snprintf(rom->reason, sizeof(rom->reason), "%s", reason);
+		atomic_store(&rom->failed, segment + 1);
+	}
+	pthread_mutex_unlock(&fail_lock);
+}
+
+static void check_stop(struct rom *rom, unsigned int segment,
+                       struct my6502 *cpu, enum my6502_stop stop)
+{
+	char reason[128];
+
+	if (stop != MY6502_STOP_TRAP) {
+		snprintf(reason, sizeof(reason), "no trap after %llu"
+			" instructions, pc=%04x",
+			(unsigned long long)cpu->instructions, cpu->pc);
+		fail(rom, segment, reason);
+	} else if (cpu->pc != rom->success) {
+		snprintf(reason, sizeof(reason), "trapped at pc=%04x after"
+			" %llu instructions", cpu->pc,
+			(unsigned long long)cpu->instructions);
+		fail(rom, segment, reason);
+	}
+}
+
+/* Run a ROM from reset to the end, writing checkpoints with -w. */
+static void run_rom(struct my6502 *cpu, struct rom *rom)
+{
+	char file_name[2 * PATH_MAX];
+	struct checkpoint *c = NULL;
+	enum my6502_stop stop;
+	uint64_t left, n;
+	FILE *f = NULL;
+
+	my6502_map(cpu, 0, MEM_SZ, (uint8_t *)rom->image, MY6502_MAP_COW);
+	my6502_reset(cpu, rom->start);
+	cpu->instructions = 0;
+	cpu->cycles = 0;
+
+	if (record) {
+		checkpoint_name(rom, file_name, sizeof(file_name));
+		f = fopen(file_name, "wb");
+		c = malloc(sizeof(*c));
+		if (!f || !c) {
+			fail(rom, 0, "can't write checkpoints");
+			free(c);
+			if (f) {
+				fclose(f);
+			}
+			return;
+		}
+	}
+
+	left = rom->max_instructions;
+	do {
+		if (f) {
+			checkpoint_take(cpu, MY6502_STOP_BUDGET, c);
+			fwrite(c, sizeof(*c), 1, f);
+		}
+		n = checkpoint_steps && checkpoint_steps < left
+			? checkpoint_steps : left;
+		stop = my6502_run(cpu, n);
+		left = rom->max_instructions - cpu->instructions;
+	} while (stop == MY6502_STOP_BUDGET && left);
+
+	if (f) {
+		checkpoint_take(cpu, stop, c);
+		fwrite(c, sizeof(*c), 1, f);
+		if (fclose(f)) {
+			fail(rom, 0, "can't write checkpoints");
+		}
+		free(c);
+	}
+
+	rom->instructions = cpu->instructions;
+	check_stop(rom, 0, cpu, stop);
+}
+
+/* Run from a checkpoint to the next one and compare the state. */
+static void run_segment(struct my6502 *cpu, struct rom *rom,
+                        unsigned int segment)
+{
+	const struct checkpoint *from = &rom->checkpoints[segment];
+	const struct checkpoint *to = from + 1;
+	enum my6502_stop stop;
+	char reason[128];
+
+	checkpoint_restore(cpu, from);
+	stop = my6502_run(cpu, to->instructions - from->instructions);
+
+	if (stop != to->stop || checkpoint_cmp(cpu, to, reason,
+		sizeof(reason))) {
+		if (stop != to->stop) {
+			snprintf(reason, sizeof(reason), "segment %u stopped"
+				" at %llu instructions, pc=%04x", segment,
+				(unsigned long long)cpu->instructions, cpu->pc);
+		}
+		fail(rom, segment, reason);
+		return;
+	}
+
+	if (segment + 2 == rom->checkpoint_count) {
+		rom->instructions = cpu->instructions;
+		check_stop(rom, segment, cpu, stop);
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct my6502 *cpu = malloc(sizeof(*cpu));
+	unsigned int i, failed;
+	struct job *job;
+
+	assert(cpu);
+	my6502_init(cpu, NULL, NULL);
+	if (my6502_block_cache(cpu, 1)) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	while ((i = atomic_fetch_add(&next_job, 1)) < job_count) {
+		job = &jobs[i];
+		/* Nothing to learn from the segments after a failure. */
+		failed = atomic_load(&job->rom->failed);
+		if (failed && job->segment >= failed - 1) {
+			continue;
+		}
+
+		if (job->rom->checkpoints) {
+			run_segment(cpu, job->rom, job->segment);
+		} else {
+			run_rom(cpu, job->rom);
+		}
+	}
+
+	my6502_map(cpu, 0, MEM_SZ, NULL, 0);
+	my6502_block_cache(cpu, 0);
+	free(cpu);
+	return NULL;
+}
+
+static void add_job(struct rom *rom, unsigned int segment)
+{
+	jobs = realloc(jobs, (job_count + 1) * sizeof(*jobs));
+	assert(jobs);
+	jobs[job_count].rom = rom;
+	jobs[job_count].segment = segment;
+	job_count++;
+}
+
+static void usage(void)
+{
+	printf("Usage: %s [-j <threads>] [-s <shard>/<shards>]"
+		" [-d <dir> [-w] [-c <insns>]]\n"
+		"       <manifest>\n"
+		"  -j  worker threads, one per CPU by default\n"
+		"  -s  verify the ROMs of a shard only, e.g. 0/4 on the first"
+		" of four nodes\n"
+		"  -d  verify segments from the checkpoints in a directory\n"
+		"  -w  run the ROMs whole and write the checkpoints instead\n"
+		"  -c  instructions between checkpoints, 1000000 by default\n"
+		"A manifest line is \"<rom.bin> <start> <success> [<insns>]\","
+		" a ROM passes\n"
+		"trapping at the success address within insns, 1000000000 by"
+		" default.\n",
+		getprogname());
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int shard = 0, shards = 1, passed = 0, total = 0, i, j;
+	pthread_t *tids;
+	struct rom *rom;
+	double t;
+	int opt;
+
+	checkpoint_steps = 1000000;
+	while ((opt = getopt(argc, argv, "j:s:d:wc:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (sscanf(optarg, "%u/%u", &shard, &shards) != 2
+				|| shard >= shards) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'd':
+			checkpoint_dir = optarg;
+			break;
+		case 'w':
+			record = 1;
+			break;
+		case 'c':
+			checkpoint_steps = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1 || !threads || !checkpoint_steps
+		|| (record && !checkpoint_dir)) {
+		usage();
+		return 1;
+	}
+
+	if (load_manifest(argv[optind])) {
+		return 1;
+	}
+
+	/* A ROM is verified by a single node, its segments by any of the
+	 * threads. */
+	for (i = shard; i < rom_count; i += shards) {
+		rom = &roms[i];
+		if (load_rom(rom)) {
+			printf("can't load %s\n", rom->file_name);
+			return 1;
+		}
+		if (checkpoint_dir && !record) {
+			if (load_checkpoints(rom)) {
+				printf("no checkpoints for %s\n",
+					rom->file_name);
+				return 1;
+			}
+			for (j = 0; j + 1 < rom->checkpoint_count; j++) {
+				add_job(rom, j);
+			}
+		} else {
+			add_job(rom, 0);
+		}
+	}
+
+	t = now();
+	tids = calloc(threads, sizeof(*tids));
+	assert(tids);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, worker, NULL)) {
+			printf("can't start a worker\n");
+			return 1;
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	t = now() - t;
+
+	/* One line per ROM, so that the reports of the shards add up. */
+	for (i = shard; i < rom_count; i += shards) {
+		rom = &roms[i];
+		total++;
+		if (atomic_load(&rom->failed)) {
+			printf("fail %s: %s\n", rom->file_name, rom->reason);
+			continue;
+		}
+		printf("pass %s: %llu instructions\n", rom->file_name,
+			(unsigned long long)rom->instructions);
+		passed++;
+	}
+
+	printf("%u of %u passed, %u jobs on %u threads in %.2fs\n", passed,
+		total, job_count, threads, t);
+
+	return passed != total;
+}